@@ -0,0 +1,141 @@
+#!/bin/bash
+# Throughput of json2sh on a generated corpus.
+#
+#	bench.sh [CASE..]
+#
+# Cases: flat deep strings numbers unicode records, default all.
+# The corpus is generated once into $BENCH_DIR, about $BENCH_MB MB
+# per case, with a fixed seed, so runs are comparable.  Each case
+# runs $BENCH_REPS times in a fresh bash, with $BENCH_OPTS added to
+# the json2sh options and the output to /dev/null.
+#
+# Reported: MB/s and nodes/s of the best run, the peak RSS of the
+# bash process and the -S counters of the last run.
+
+LC_ALL=C
+export LC_ALL
+
+: "${BENCH_SO:=src/.libs/hello.so}"
+: "${BENCH_DIR:=bench.d}"
+: "${BENCH_MB:=4}"
+: "${BENCH_REPS:=5}"
+: "${BENCH_OPTS:=}"
+
+CASES="flat deep strings numbers unicode records"
+
+# gen CASE > FILE
+# rnd() is the Park-Miller generator, exact in doubles, as awk's
+# rand() differs between implementations
+gen()
+{
+	awk -v what="$1" -v size="$((BENCH_MB * 1024 * 1024))" '
+	function rnd(n)	{ seed = (seed * 16807) % 2147483647; return seed % n }
+	function word(	s, i, n) { n = 3 + rnd(8); s = ""; for (i = 0; i < n; i++) s = s substr("abcdefghijklmnopqrstuvwxyz", 1 + rnd(26), 1); return s }
+	function out(s)	{ printf "%s", s; len += length(s) }
+	function number(	r)
+	{
+		r = rnd(4)
+		if (r == 0)	return rnd(100)
+		if (r == 1)	return "-" (1 + rnd(2147483646)) rnd(100000)
+		if (r == 2)	return rnd(100000) "." rnd(1000000)
+		return rnd(10) "." rnd(1000) "e" (rnd(2) ? "-" : "") rnd(300)
+	}
+	BEGIN {
+		seed = 4711
+		out("[\n")
+		for (n = 0; len < size; n++)
+		{
+			if (n)	out(",\n")
+			if (what == "flat")
+			{
+				out("{")
+				for (i = 0; i < 200; i++)
+					out((i ? "," : "") "\"" word() i "\":" (rnd(2) ? "\"" word() "\"" : number()))
+				out("}")
+			}
+			else if (what == "deep")
+			{
+				d = 100 + rnd(400)
+				for (i = 0; i < d; i++)	out(i % 2 ? "[" : "{\"" word() "\":")
+				out("\"" word() "\"")
+				for (i = d; i-- > 0; )	out(i % 2 ? "]" : "}")
+			}
+			else if (what == "strings")
+			{
+				s = ""
+				for (i = 1000 + rnd(8000); length(s) < i; )
+					s = s word() (rnd(20) ? " " : rnd(2) ? "\\n" : "\\\"")
+				out("\"" s "\"")
+			}
+			else if (what == "numbers")
+			{
+				out("[")
+				for (i = 0; i < 100; i++)	out((i ? "," : "") number())
+				out("]")
+			}
+			else if (what == "unicode")
+			{
+				s = ""
+				for (i = 0; i < 100; i++)
+				{
+					r = rnd(6)
+					s = s (r == 0 ? "\303\244\303\266\303\274" : r == 1 ? "\342\202\254" : r == 2 ? "\360\237\230\200" : r == 3 ? "\\u00e9\\u20ac" : r == 4 ? "\\ud83d\\ude00" : word())
+				}
+				out("{\"" word() "\303\251\":\"" s "\"}")
+			}
+			else
+			{
+				out("{\"id\":" n ",\"name\":\"" word() " " word() "\",\"email\":\"" word() "@example.com\",")
+				out("\"active\":" (rnd(2) ? "true" : "false") ",\"score\":" number() ",\"tags\":[")
+				for (i = rnd(4); i-- > 0; )	out("\"" word() "\"" (i ? "," : ""))
+				out("],\"addr\":{\"street\":\"" rnd(1000) " " word() " St\",\"zip\":\"" rnd(100000) "\"},\"note\":null}")
+			}
+		}
+		out("\n]\n")
+	}'
+}
+
+# run CASE FILE, prints one line
+run()
+{
+	bash -c '
+	enable -f "$1" json2sh || exit
+	JSON2SH_CACHE=0		# each run parses
+	file=$2 reps=$3
+	shift 3
+	best=
+	for ((i = 0; i < reps; i++))
+	do
+		t0=$EPOCHREALTIME
+		json2sh -S "$@" -f "$file" > /dev/null 2> "$file.stats" || { cat "$file.stats" >&2; exit 1; }
+		t1=$EPOCHREALTIME
+		t=$(( ${t1/./} - ${t0/./} ))
+		[ -z "$best" ] || [ "$t" -lt "$best" ] && best=$t
+	done
+	rss=-
+	[ -r /proc/$BASHPID/status ] && rss=$(awk "/^VmHWM:/ { print \$2 }" /proc/$BASHPID/status)
+	echo "$best $rss $(cat "$file.stats")"
+	' bench "$BENCH_SO" "$2" "$BENCH_REPS" $BENCH_OPTS |
+	awk -v what="$1" -v bytes="$(wc -c < "$2")" '{
+		sub(/json2sh: /, "")
+		gsub(/,/, "")
+		us = $1 > 0 ? $1 : 1
+		# us rss nodes N allocs N mallocs N bytes N keys N cached N
+		printf "%-8s %8.1f MB %9.1f MB/s %12.0f nodes/s %8s KB rss %9s nodes %7s allocs %5s mallocs %6s keys %6s cached\n",
+			what, bytes / 1000000, bytes / us, $4 * 1000000 / us, $2, $4, $6, $8, $12, $14
+	}'
+}
+
+[ -r "$BENCH_SO" ] || { echo "bench.sh: $BENCH_SO missing, run make first" >&2; exit 1; }
+mkdir -p "$BENCH_DIR" || exit
+
+for c in ${*:-$CASES}
+do
+	case " $CASES " in
+	*" $c "*)	;;
+	*)		echo "bench.sh: unknown case $c" >&2; exit 1;;
+	esac
+	f="$BENCH_DIR/$c-$BENCH_MB.json"
+	[ -s "$f" ] || gen "$c" > "$f" || exit
+	run "$c" "$f" || exit
+done
@@ -1,7 +1,7 @@
+#include <config.h>
 #if defined (HAVE_UNISTD_H)
 #  include <unistd.h>
 #endif
-#include <config.h>
 #include <stdio.h>
 #include "builtins.h"
 #include "shell.h"
@@ -10,20 +10,420 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdarg.h>
-#include <ctype.h>
+#include <setjmp.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#if !defined (JSON2SH_NO_SIMD) && defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#  define JSON2SH_X86    1
+#  include <immintrin.h>
+#endif
 #include "base64simple.h"
 #define BASE64_ENCODED_COUNT    4
 #define BASE64_DECODED_COUNT    3
 #define JSON2SH_VERSION         "2.0"
 #define JSON2SH_NAME            "json2sh"
-#define NUMBER_OF_STRING        2
-#define MAX_STRING_SIZE         40
+#define JSON2SH_BLOCK           (64 * 1024)
+#define JSON2SH_OOPS            23      /* status on errors, was exit(23)	*/
+#define JSON2SH_PATHS           32      /* max -p, bits in BASE->match	*/
+#define JSON2SH_DEPTH           1000    /* default for -d	*/
+#define JSON2SH_ARENA           (64 * 1024)     /* first arena chunk	*/
+#define JSON2SH_ARENA_KEEP      (1024 * 1024)   /* kept between runs	*/
+#define JSON2SH_KEYS            256     /* key name cache slots, power of 2	*/
+#define JSON2SH_KEYLEN          64      /* longer keys are not cached	*/
+#define JSON2SH_CACHE_MAX       (16 * 1024 * 1024)      /* default for $JSON2SH_CACHE	*/
+#define JSON2SH_JOBS            256     /* max -j	*/
+
+/**********************************************************************
+ * CONTEXT
+ *********************************************************************/
+
+struct _buf
+{
+    char   *buf;
+    size_t len, max;
+};
+
+/* All output goes to a sink:
+ *  SINK_FD	buffered, written with write(2) when full or on close
+ *  SINK_MEM	growable buffer, the caller takes buf/len
+ *  SINK_VAR	growable buffer, bound to the shell variable on close
+ * In bind_mode output is a SINK_MEM which only collects the
+ * variable name: nl() starts a new name, base_bind() consumes it.
+ */
+enum sink_type
+{
+    SINK_FD = 0,
+    SINK_MEM,
+    SINK_VAR,
+};
+
+struct sink
+{
+    enum sink_type type;
+    int            fd;                  /* SINK_FD	*/
+    const char     *var;                /* SINK_VAR	*/
+    char           *buf;
+    size_t         len, max;
+    struct _buf    *copy;               /* SINK_FD: also collect flushed output here	*/
+    size_t         copymax;             /* up to this, else copy is dropped	*/
+};
+
+/* Identity of a mapped input file.
+ * The output cache and query take it as unchanged if it is equal.
+ */
+struct ident
+{
+    dev_t           dev;
+    ino_t           ino;
+    off_t           size;
+    struct timespec mtime;
+};
+
+/* Input is read in blocks of JSON2SH_BLOCK with read(2).
+ * pos is the cursor into buf, so pushing back the one character
+ * of lookahead is just pos--.  A block is only discarded when
+ * get() needs more, so pos is never 0 after a get().
+ *
+ * A regular file given with -f is mapped instead (maplen != 0).
+ * Then buf is the whole file and in_fill() has nothing to do.
+ *
+ * line/column are not maintained per character:
+ * lines/col count what was in the discarded blocks,
+ * in_where() adds the current block up to pos.
+ */
+struct input
+{
+    int           fd;
+    unsigned char *buf;
+    size_t        pos, len;
+    int           lines;
+    size_t        col;
+    unsigned char *block;               /* buf when not mapped	*/
+    size_t        maplen;
+    int           mem;                  /* buf is all of the input, not ours	*/
+    int           regular;              /* a mapped file, id is valid	*/
+    struct ident  id;
+    int           close;                /* fd is ours	*/
+    int           indexed;              /* see ix_word()	*/
+    uint64_t      *ix;
+    size_t        ixlo, ixhi;
+    uint64_t      ixstr;
+    int           ixesc;
+    size_t        ixfrom;               /* where ix_start() was, bytes before are blanks	*/
+};
+
+typedef struct base *BASE;
+
+/* Nodes and their buffers are bumped from chunks, which are
+ * only given back all at once by arena_reset().
+ */
+struct chunk
+{
+    struct chunk *next;
+    size_t       size;
+    char         mem[];
+};
+
+struct arena
+{
+    struct chunk  *first, *cur;         /* cur NULL: before first	*/
+    size_t        off;                  /* into cur	*/
+    unsigned long nodes;                /* counters for -S, per run	*/
+    unsigned long allocs;
+    unsigned long mallocs;
+    size_t        bytes;
+};
+
+/* A cached key name: the raw key (as from uniget()) and the
+ * escaped name it gave.  Escaping depends on the esc/cp state
+ * of the node, so that is part of the key as well as the result.
+ */
+struct keyent
+{
+    unsigned    hash;
+    unsigned    esc, cp;                /* before	*/
+    unsigned    esc2, cp2;              /* after	*/
+    struct _buf raw, name;
+};
+
+/* A -p selector, split into nseg names.
+ * Dotted paths match with fnmatch(3), JSON Pointers exactly.
+ */
+struct path
+{
+    int  glob;
+    int  nseg;
+    char **seg;
+};
+
+/* The tape of a query handle: one entry per value and key,
+ * in document order.  A value ends before entry next, so get
+ * steps over a member at once.
+ */
+enum tape_type
+{
+    T_OBJ = 1,
+    T_ARR,
+    T_KEY,
+    T_STR,
+    T_NUM,
+    T_CONST,
+};
+
+struct tent
+{
+    size_t        off, len;             /* the JSON text	*/
+    uint32_t      next;                 /* entry after the value	*/
+    uint32_t      n;                    /* members or elements	*/
+    unsigned char type;
+    unsigned char plain;                /* string without escapes	*/
+};
+
+struct tape
+{
+    struct tape   *next;
+    char          *name;
+    unsigned char *text;                /* all of the input	*/
+    size_t        len;
+    struct tent   *ent;
+    uint32_t      n, max;
+    uint32_t      *open;                /* query: open containers	*/
+    int           openmax;
+    int           regular;              /* id is the file it came from	*/
+    struct ident  id;
+};
+
+/* Output of an earlier run.  key are the words of the command,
+ * each NUL terminated, so options are part of it.
+ */
+struct cached
+{
+    struct cached *next;
+    struct ident  id;
+    struct _buf   key, out;
+};
+
+/* -l while binding: the input unless it is mapped, and where
+ * the last value was, to count lines and columns from there
+ */
+struct lazydoc
+{
+    unsigned char *text;
+    size_t        len;
+    size_t        pos, col;
+    int           line;
+};
+
+/* A lazy variable not read yet, hashed by its name.  The JSON
+ * text of the value is the variable's, line and col are where
+ * it was in the input, for errors.
+ */
+struct lazy
+{
+    struct lazy *next;
+    unsigned    hash;
+    int         line;
+    size_t      col;
+    char        name[];
+};
+
+/* -j: a FILE, or a chunk of the top-level array,
+ * parsed by a worker into out
+ */
+struct job
+{
+    const char    *file;
+    int           nr;                   /* counting from 1, for the names	*/
+    size_t        off, end;             /* a chunk: where it and the next start	*/
+    size_t        stop;                 /* a chunk: where it stopped	*/
+    int           first, n;             /* numbered from first	*/
+    int           printed;              /* a chunk: some element was output	*/
+    int           closed;               /* a chunk: it read the ']'	*/
+    int           done;                 /* under batch.lock	*/
+    int           ret;
+    char          err[256];
+    struct _buf   out;
+    unsigned long nodes, allocs, mallocs, keyhits, keymisses;   /* -S	*/
+    size_t        bytes;
+};
+
+/* -j without FILEs: a piece of the input, which the scan
+ * looks at for a top-level ','
+ */
+struct range
+{
+    size_t lo, hi;
+    int    quotes, esc;                 /* '"' odd, hi escaped: if lo is not	*/
+    int    str, escaped;                /* at lo: in a string, escaped	*/
+    long   delta, min;                  /* of the depth, at a ',': from lo	*/
+    size_t commas, comma;               /* at min: how many, the first	*/
+};
+
+/* -j: the jobs, and the options of the shell's run
+ * the workers take over
+ */
+struct batch
+{
+    struct job      *jobs;
+    int             n, max, next;
+    struct range    *ranges;            /* chunks: for the scan	*/
+    int             nranges;
+    void            (*pass)(struct batch *, struct range *);
+    pthread_mutex_t lock;
+    pthread_cond_t  done;               /* a job is done	*/
+    struct json2sh  *shell;
+    const char      *rs;
+    char            **paths;
+    int             npaths;
+    unsigned char   *text;              /* chunks: all of the input	*/
+    size_t          len;
+    int             lines;              /* chunks: some output was written	*/
+    int             printed;            /* chunks: some element was output	*/
+    int             closed;             /* chunks: the ']' was read	*/
+    size_t          stop;               /* chunks: after it	*/
+    char            err[256];           /* chunks: after the ']'	*/
+};
+
+/* A level of the name in J->path: which node it was copied
+ * from, how much of it, and where it starts.
+ */
+struct level
+{
+    unsigned long gen;
+    int           pos;
+    size_t        off;
+};
+
+/* An open container on the parser's stack
+ */
+struct frame
+{
+    BASE b;
+    int  n;                             /* members seen	*/
+    int  obj;
+    int  scalars;                       /* -a: values go to vals	*/
+    int  assoc;                         /* -A: KEY and VALUE go to vals	*/
+    int  ref;                           /* -A: the parent wants our name	*/
+    struct sink vals;                   /* NUL terminated, kept with the slot	*/
+};
+
+/* Everything a parse needs.  J points to the one in use by this
+ * thread.  All buffers and the node pool stay allocated between
+ * runs, so a context is warm when it is used again.
+ */
+struct json2sh
+{
+    int          busy;                  /* J points here	*/
+    jmp_buf      oops;                  /* where OOPS() returns to	*/
+    char         err[256];              /* and the message it left	*/
+    BASE         root;                  /* of the chain being parsed	*/
+    int          line;                  /* only valid after in_where()	*/
+    int          column;                /* only valid after in_where()	*/
+    struct _buf  pref, sep, lf;
+    int          bind_mode;             /* -b: bind_variable() each leaf instead of printing	*/
+    int          stream;                /* -s: parse values until EOF	*/
+    struct _buf  rs;                    /* -r: printed after each record	*/
+    const char   *callback;             /* -C: evaluated after each record	*/
+    struct _buf  bound;                 /* -s -b: names bound by this record	*/
+    struct path  paths[JSON2SH_PATHS];  /* -p	*/
+    int          npaths;
+    struct _buf  key;                   /* -p: raw key to match, UTF-8	*/
+    int          *keyv;                 /* -p: and as it came from uniget()	*/
+    size_t       keyn, keymax;
+    struct keyent *keys;                /* JSON2SH_KEYS	*/
+    unsigned long keyhits, keymisses;   /* -S	*/
+    struct input in;
+    struct sink  out;
+    int          lines;                 /* printed in this record	*/
+    BASE         freelist;              /* of nodes from the arena	*/
+    unsigned long gen;                  /* of the last node created	*/
+    struct _buf  path;                  /* the last name printed	*/
+    struct level *lvl;                  /* and where it came from	*/
+    size_t       nlvl, lvlmax;
+    struct arena arena;
+    int          stats;                 /* -S	*/
+    int          arrays;                /* -a	*/
+    int          assoc;                 /* -A	*/
+    int          integers;              /* -i	*/
+    struct _buf  num;                   /* the number just scanned	*/
+    int          ref;                   /* -A: for the next j_open()	*/
+    struct frame *elem;                 /* J->out is swapped with its vals	*/
+    struct frame *stack;                /* j_value()	*/
+    int          depth, stackmax;
+    int          maxdepth;              /* -d	*/
+    struct tape  *tape;                 /* query: being built	*/
+    struct _buf  ckey;                  /* the key into the output cache	*/
+    struct _buf  cout;                  /* and the output collected for it	*/
+    struct lazydoc *lazy;               /* -l: the input being bound	*/
+    int          nr;                    /* -j: the FILE, counting from 1	*/
+    struct _buf  whole;                 /* -j: the input, unless mapped	*/
+};
+
+static __thread struct json2sh *J;
+
+
+/**********************************************************************
+ * CHARACTER CLASSES
+ *********************************************************************/
 
-static int         line;
-static int         column;
-static struct _buf *PREF, *SEP, *LF;
+/* Byte classes, shared by the lexer, the name escaper and the
+ * value quoter.  No <ctype.h>, so nothing depends on the locale.
+ */
+#define C_SPACE     0x01                /* skipped between tokens	*/
+#define C_NAME      0x02                /* 0-9 A-Z a-z, kept as is in names and values	*/
+#define C_QUOTED    0x04                /* kept as is in '..' and $'..'	*/
+#define C_PRINT     0x08                /* printable ASCII, for messages	*/
+#define C_END       0x10                /* ends a number or constant	*/
+#define C_STOP      0x20                /* " \\ and controls end a run in a string	*/
+
+#define CLS(c, m)    (((unsigned)(c) < 256) && (cls[(unsigned)(c)] & (m)))
+
+static const unsigned char cls[256] =
+{
+    [' ' ... '~']   = C_QUOTED | C_PRINT,
+    [128 ... 255]   = C_QUOTED,
+    [0 ... 31]      = C_STOP,
+    ['"']           = C_QUOTED | C_PRINT | C_STOP,
+    ['\\']          = C_QUOTED | C_PRINT | C_STOP,
+    ['0' ... '9']   = C_NAME | C_QUOTED | C_PRINT,
+    ['A' ... 'Z']   = C_NAME | C_QUOTED | C_PRINT,
+    ['a' ... 'z']   = C_NAME | C_QUOTED | C_PRINT,
+    ['\'']          = C_PRINT,
+    [' ']           = C_SPACE | C_QUOTED | C_PRINT | C_END,
+    ['\t']          = C_SPACE | C_END | C_STOP,
+    ['\n']          = C_SPACE | C_END | C_STOP,
+    ['\v']          = C_SPACE | C_END | C_STOP,
+    ['\f']          = C_SPACE | C_END | C_STOP,
+    ['\r']          = C_SPACE | C_END | C_STOP,
+    [',']           = C_QUOTED | C_PRINT | C_END,
+    [']']           = C_QUOTED | C_PRINT | C_END,
+    ['}']           = C_QUOTED | C_PRINT | C_END,
+};
+
+/* Letter for the escape in $'..', see oute()
+ */
+static const char esc_ansi[256] =
+{
+    ['\''] = '\'', ['\\'] = '\\', ['\a'] = 'a', ['\033'] = 'e',
+    ['\f'] = 'f', ['\n'] = 'n', ['\r'] = 'r', ['\t'] = 't', ['\v'] = 'v',
+};
+
+/* Letter for the escape in variable names, see base_escape()
+ */
+static const char esc_name[256] =
+{
+    ['\a'] = 'a', ['\b'] = 'b', ['\177'] = 'd', ['\033'] = 'e',
+    ['\f'] = 'f', ['\n'] = 'n', ['\r'] = 'r', ['\t'] = 't', ['\v'] = 'v',
+};
 
 
 #if 0
@@ -44,7 +444,7 @@ debug_printf(const char *file, int line, const char *fn, const char *s, ...)
 
 static int cc(char c)
 {
-    return c < 0 || !isprint(c) ? '?' : c;
+    return CLS(c, C_PRINT) ? c : '?';
 }
 
 
@@ -61,47 +461,167 @@ static int cc(char c)
 
 
 
+static void in_where(void);
+static void sink_flush(struct sink *o);
+static void OOPS(const char *s, ...) __attribute__((__noreturn__));
+static void elem_swap(struct frame *f);
+static void lazy_bind(size_t off, size_t len);
+static void lazy_close(void);
+
+/* Never exit, we might run inside of the shell.
+ * Leave the message in J->err and return to the setjmp()
+ * of the run, which cleans up.  Output so far is flushed.
+ */
 static void
 OOPS(const char *s, ...)
 {
-    int e = errno;
-
     va_list list;
+    int     len;
 
-    fflush(stdout);
+    if (J->elem)
+    {
+        elem_swap(J->elem);
+    }
+    sink_flush(&J->out);
 
-    fprintf(stderr, JSON2SH_NAME ":%d:%d: ", line + 1, column + 1);
+    in_where();
+    len = snprintf(J->err, sizeof J->err, "%d:%d: ", J->line + 1, J->column + 1);
     va_start(list, s);
-    vfprintf(stderr, s, list);
+    vsnprintf(J->err + len, sizeof J->err - len, s, list);
     va_end(list);
-    fprintf(stderr, ": ");
 
-    errno = e;
-    perror(NULL);
-    fflush(stderr);
-
-    exit(23);
+    longjmp(J->oops, 1);
 }
 
 
 static void
 OOPSc(int c, const char *s)
 {
-    OOPS("%s with character %c (%02x)", s, isprint(c) ? c : ' ', c);
+    OOPS("%s with character %c (%02x)", s, CLS(c, C_PRINT) ? c : ' ', c);
+}
+
+
+static void *re_alloc(void *buf, size_t len);
+static void buf_add(struct _buf *b, const char *s, size_t len);
+
+static void
+sink_flush(struct sink *o)
+{
+    size_t  pos;
+    ssize_t got;
+
+    if (o->type != SINK_FD)
+    {
+        return;
+    }
+    if (o->copy)
+    {
+        if (o->copy->len + o->len > o->copymax)
+        {
+            o->copy = NULL;
+        }
+        else
+        {
+            buf_add(o->copy, o->buf, o->len);
+        }
+    }
+    for (pos = 0; pos < o->len; pos += got)
+    {
+        if ((got = write(o->fd, o->buf + pos, o->len - pos)) < 0)
+        {
+            if (errno == EINTR)
+            {
+                got = 0;
+                continue;
+            }
+            o->len = 0;
+            OOPS("write error: %s", strerror(errno));
+        }
+    }
+    o->len = 0;
+}
+
+
+/* Make room for len more bytes
+ */
+static void
+sink_need(struct sink *o, size_t len)
+{
+    if (o->len + len <= o->max)
+    {
+        return;
+    }
+    sink_flush(o);
+    if (o->len + len > o->max)
+    {
+        o->max = o->len + len > JSON2SH_BLOCK ? (o->len + len) * 2 : JSON2SH_BLOCK;
+        o->buf = re_alloc(o->buf, o->max);
+    }
+}
+
+
+/* The buffer is kept for the next use
+ */
+static void
+sink_init(struct sink *o, enum sink_type type, int fd, const char *var)
+{
+    if (type == SINK_FD)
+    {
+        fflush(stdout);
+    }
+    o->type = type;
+    o->fd   = fd;
+    o->var  = var;
+    o->len  = 0;
+    o->copy = NULL;
+}
+
+
+/* Unless ok, output is dropped (SINK_VAR is not bound)
+ */
+static void
+sink_close(struct sink *o, int ok)
+{
+    switch (ok ? o->type : SINK_MEM)
+    {
+    case SINK_FD:
+        sink_flush(o);
+        break;
+
+    case SINK_VAR:
+        sink_need(o, 1);
+        o->buf[o->len] = 0;
+        bind_variable(o->var, o->buf, 0);
+        break;
+
+    case SINK_MEM:
+        break;
+    }
+    o->len = 0;
 }
 
 
 static void
 outc(char c)
 {
-    putchar(c);
+    struct sink *o = &J->out;
+
+    if (o->len >= o->max)
+    {
+        sink_need(o, 1);
+    }
+    o->buf[o->len++] = c;
 }
 
 
 static void
 outn(const char *s, size_t len)
 {
-    fwrite(s, len, 1, stdout);
+    struct sink *o = &J->out;
+
+    sink_need(o, len);
+    memcpy(o->buf + o->len, s, len);
+    o->len += len;
 }
 
 
@@ -120,14 +640,32 @@ static void outb(struct _buf *b);
 static void
 nl(void)
 {
-    outb(LF);
+    if (J->bind_mode)
+    {
+        J->out.len = 0;
+        return;
+    }
+    outb(&J->lf);
 }
 
 
 static void
 vout(const char *s, va_list list)
 {
-    vprintf(s, list);
+    struct sink *o = &J->out;
+    va_list     copy;
+    int         len;
+
+    va_copy(copy, list);
+    len = vsnprintf(NULL, 0, s, copy);
+    va_end(copy);
+    if (len < 0)
+    {
+        OOPS("output error");
+    }
+    sink_need(o, len + 1);
+    vsnprintf(o->buf + o->len, len + 1, s, list);
+    o->len += len;
 }
 
 
@@ -141,51 +679,13 @@ outx(int ch)
 static void
 oute(int ch)
 {
-    switch (ch)
+    if (((unsigned)ch < 256) && esc_ansi[ch])
     {
-    case '\'':
-    case '\\':
-        outc('\\');
-        outc(ch);
-        return;
-
-    case '\a':
-        outc('\\');
-        outc('a');
-        return;
-
-    case '\033':
-        outc('\\');
-        outc('e');
-        return;
-
-    case '\f':
-        outc('\\');
-        outc('f');
-        return;
-
-    case '\n':
-        outc('\\');
-        outc('n');
-        return;
-
-    case '\r':
         outc('\\');
-        outc('r');
-        return;
-
-    case '\t':
-        outc('\\');
-        outc('t');
-        return;
-
-    case '\v':
-        outc('\\');
-        outc('v');
+        outc(esc_ansi[ch]);
         return;
     }
-
-    if ((ch >= ' ') && (ch <= 255) && (ch != 127))
+    if (CLS(ch, C_QUOTED))
     {
         outc(ch);
         return;
@@ -389,12 +889,6 @@ unescape(char *dest, const char *s, size_t len, char esc)
  * MISC
  *********************************************************************/
 
-struct _buf
-{
-    const char *buf;
-    size_t     len;
-};
-
 static void
 outb(struct _buf *b)
 {
@@ -438,959 +932,4707 @@ re_alloc(void *buf, size_t len)
 }
 
 
-struct _buf *
-buf(const char *s)
+/* Append to b
+ */
+static void
+buf_add(struct _buf *b, const char *s, size_t len)
 {
-    struct _buf *b;
-    char        *tmp;
-    size_t      len;
+    if (b->len + len >= b->max)
+    {
+        b->max = (b->len + len) * 2 + 64;
+        b->buf = re_alloc(b->buf, b->max);
+    }
+    if (len)
+    {
+        memcpy(b->buf + b->len, s, len);
+    }
+    b->len += len;
+}
+
+
+/* Set b to s, reusing the memory b already has
+ */
+static void
+buf(struct _buf *b, const char *s)
+{
+    size_t len = strlen(s);
 
-    b      = alloc0(sizeof *b);
-    b->len = len = strlen(s);
-    b->buf = tmp = alloc0(b->len + 1);
-    memcpy(tmp, s, len);
+    if (len >= b->max)
+    {
+        b->max = len + 1;
+        b->buf = re_alloc(b->buf, b->max);
+    }
+    b->len = len;
+    memcpy(b->buf, s, len + 1);
 
     /* If buf is surrounded by $'...' do some shell unescape.
      * Ignore leftover bytes, so do not realloc to shrink ..
      */
     if (*s == '\\')
     {
-        b->len = unescape(tmp, s, len, '\\');
+        b->len = unescape(b->buf, s, len, '\\');
     }
-    return b;
 }
 
 
 /**********************************************************************
- * INPUT
+ * ARENA
  *********************************************************************/
-static int
-get(void)
-{
-    int c;
 
-    if ((c = getchar()) == '\n')
-    {
-        line++;
-        column = 0;
-    }
-    else if (c != EOF)
+#define ARENA_ALIGN(n)    (((n) + 15) & ~(size_t)15)
+
+static void *
+arena_alloc(size_t len)
+{
+    struct arena *a = &J->arena;
+    struct chunk *c, **next;
+    size_t       size;
+    void         *ptr;
+
+    len = ARENA_ALIGN(len);
+    a->allocs++;
+    a->bytes += len;
+    while (!a->cur || (a->off + len > a->cur->size))
     {
-        column++;
+        next = a->cur ? &a->cur->next : &a->first;
+        if (!*next || (len > (*next)->size))
+        {
+            /* insert a bigger chunk	*/
+            size = a->cur ? 2 * a->cur->size : JSON2SH_ARENA;
+            if (size < len)
+            {
+                size = len;
+            }
+            c       = alloc0(sizeof *c + size);
+            c->size = size;
+            c->next = *next;
+            *next   = c;
+            a->mallocs++;
+        }
+        a->cur = *next;
+        a->off = 0;
     }
-    xD("(%d %c)", c, cc(c));
-    return c;
+    ptr     = a->cur->mem + a->off;
+    a->off += len;
+    return ptr;
 }
 
 
-static int
-next(void)
+/* Forget all nodes at once.
+ * The chunks stay for the next run, up to JSON2SH_ARENA_KEEP.
+ */
+static void
+arena_reset(struct arena *a)
 {
-    int c;
+    struct chunk **cp, *c;
+    size_t       kept = 0;
 
-    while ((c = get()) != EOF && isspace(c))
+    for (cp = &a->first; (c = *cp); )
     {
+        if (kept + c->size > JSON2SH_ARENA_KEEP)
+        {
+            *cp = c->next;
+            free(c);
+            continue;
+        }
+        kept += c->size;
+        cp    = &c->next;
     }
-    return c;
+    a->cur = NULL;
+    a->off = 0;
 }
 
 
-/* Warning: This skips whitespace	*/
-static char
-peek(void)
+/* Start of a run, also restarts the counters
+ */
+static void
+arena_init(struct arena *a)
 {
-    int c;
+    arena_reset(a);
+    a->nodes   = 0;
+    a->allocs  = 0;
+    a->mallocs = 0;
+    a->bytes   = 0;
+}
 
-    if ((c = next()) != EOF)
+
+/**********************************************************************
+ * INPUT INDEX
+ *********************************************************************/
+
+/* A structural index of the input, built 64 bytes at a time.
+ * For each chunk there are two words with one bit per byte:
+ * IX_QUOTE has the quotes which are not escaped, IX_BRACKET
+ * the { } [ ] outside of strings.  So the quote following an
+ * opening quote closes the string, and brackets can be counted
+ * without looking at the strings at all.
+ *
+ * The raw masks come from a SIMD kernel chosen at runtime
+ * (AVX2, SSE2 or plain C).  Escapes and strings are resolved
+ * in ix_chunk(), carrying the state from chunk to chunk.
+ *
+ * Only a window of IX_WORDS chunks is kept.  It moves forward
+ * with the cursor, chunks skipped on the way are still run
+ * through ix_chunk() for the carried state.
+ */
+#define IX_WORDS    (JSON2SH_BLOCK / 64)
+#define IX_BRACKET  0
+#define IX_QUOTE    1
+
+typedef void ix_kernel_t (const unsigned char *, uint64_t *, uint64_t *, uint64_t *);
+
+static void
+ix_scalar(const unsigned char *p, uint64_t *quote, uint64_t *bs, uint64_t *brk)
+{
+    uint64_t q = 0, b = 0, o = 0;
+    int      i;
+
+    for (i = 0; i < 64; i++)
     {
-        ungetc(c, stdin);
+        switch (p[i])
+        {
+        case '"':
+            q |= 1ull << i;
+            break;
+
+        case '\\':
+            b |= 1ull << i;
+            break;
+
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+            o |= 1ull << i;
+            break;
+        }
     }
-    xD("(%d %c)", c, cc(c));
-    return c;
+    *quote = q;
+    *bs    = b;
+    *brk   = o;
 }
 
 
-/* Warning: This skips whitespace	*/
-static int
-have(int want)
+#ifdef JSON2SH_X86
+/* [ is 0x5b and { is 0x7b, ] is 0x5d and } is 0x7d,
+ * so OR-ing 0x20 catches both with one compare.
+ */
+__attribute__((target("sse2")))
+static void
+ix_sse2(const unsigned char *p, uint64_t *quote, uint64_t *bs, uint64_t *brk)
 {
-    int c;
+    const __m128i q  = _mm_set1_epi8('"'), b = _mm_set1_epi8('\\');
+    const __m128i lo = _mm_set1_epi8(0x20), ob = _mm_set1_epi8('{'), cb = _mm_set1_epi8('}');
+    uint64_t      rq = 0, rb = 0, ro = 0;
+    __m128i       v, w;
+    int           i;
 
-    if (want == EOF)
+    for (i = 0; i < 64; i += 16)
     {
-        return peek() == EOF;
+        v   = _mm_loadu_si128((const __m128i *)(p + i));
+        w   = _mm_or_si128(v, lo);
+        rq |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, q)) << i;
+        rb |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, b)) << i;
+        ro |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(w, ob), _mm_cmpeq_epi8(w, cb))) << i;
     }
+    *quote = rq;
+    *bs    = rb;
+    *brk   = ro;
+}
 
-    if ((c = next()) != EOF)
+
+__attribute__((target("avx2")))
+static void
+ix_avx2(const unsigned char *p, uint64_t *quote, uint64_t *bs, uint64_t *brk)
+{
+    const __m256i q  = _mm256_set1_epi8('"'), b = _mm256_set1_epi8('\\');
+    const __m256i lo = _mm256_set1_epi8(0x20), ob = _mm256_set1_epi8('{'), cb = _mm256_set1_epi8('}');
+    uint64_t      rq = 0, rb = 0, ro = 0;
+    __m256i       v, w;
+    int           i;
+
+    for (i = 0; i < 64; i += 32)
     {
-        if (c == want)
-        {
-            return 1;
-        }
-        ungetc(c, stdin);
+        v   = _mm256_loadu_si256((const __m256i *)(p + i));
+        w   = _mm256_or_si256(v, lo);
+        rq |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, q)) << i;
+        rb |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, b)) << i;
+        ro |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(w, ob), _mm256_cmpeq_epi8(w, cb))) << i;
     }
-    return 0;
+    *quote = rq;
+    *bs    = rb;
+    *brk   = ro;
 }
 
 
-/* Warning: This skips whitespace on the first character	*/
+#endif
+
+static ix_kernel_t *ix_kernel;
+
+/* Pick the kernel, done on load
+ */
 static void
-need(const char *c)
+ix_init(void)
 {
-    int got;
-
-    xD("(%s)", c);
-    if ((got = next()) != (unsigned char)*c)
+    if (ix_kernel)
     {
-        OOPS("expected '%s' but got '%c'", c, got);
+        return;
     }
-    while (*++c)
+    ix_kernel = ix_scalar;
+#ifdef JSON2SH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
     {
-        if ((got = get()) != *c)
+        ix_kernel = ix_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        ix_kernel = ix_sse2;
+    }
+#endif
+}
+
+
+/* Of a block which ends at hi: the quotes which are not escaped
+ * go to *quote, the bits within strings are returned.  *esc and
+ * *carry take them on to the next block.
+ */
+static uint64_t
+ix_strings(uint64_t *quote, uint64_t bs, size_t hi, int *esc, uint64_t *carry)
+{
+    uint64_t e = *esc, str;
+    int      i;
+
+    /* escaped characters: the one after each odd backslash.
+     * Backslashes are rare, so just walk them.  One which ends
+     * the block, maybe within the chunk, escapes the next block.
+     */
+    bs  &= ~e;
+    *esc = 0;
+    while (bs)
+    {
+        i   = __builtin_ctzll(bs);
+        bs &= bs - 1;
+        if (i + 1 >= (int)hi)
         {
-            OOPS("missing '%s', got '%c'", c, got);
+            *esc = 1;
+            break;
         }
+        e  |= 1ull << (i + 1);
+        bs &= ~(1ull << (i + 1));
     }
+    *quote &= ~e;
+
+    /* prefix XOR: bits from an opening quote up to the closing one	*/
+    str  = *quote;
+    str ^= str << 1;
+    str ^= str << 2;
+    str ^= str << 4;
+    str ^= str << 8;
+    str ^= str << 16;
+    str ^= str << 32;
+    str ^= *carry;
+    *carry = (uint64_t)((int64_t)str >> 63);
+    return str;
 }
 
 
-/* Fetch a real character.
- * Bail out on EOF
+/* Index chunk c of the buffer into w[IX_BRACKET] and w[IX_QUOTE]
  */
-static int
-ch(void)
+static void
+ix_chunk(size_t c, uint64_t *w)
 {
-    int c;
-
-    if ((c = get()) == EOF)
+    struct input        *in = &J->in;
+    const unsigned char *p  = in->buf + (c << 6);
+    unsigned char       tmp[64];
+    uint64_t            quote, bs, brk, str;
+    size_t              lo, hi;
+
+    lo = (c << 6) < in->ixfrom ? in->ixfrom - (c << 6) : 0;
+    hi = (c << 6) + 64 > in->len ? in->len - (c << 6) : 64;
+    if ((lo > 0) || (hi < 64))
     {
-        OOPS("unexpected EOF");
+        memset(tmp, ' ', sizeof tmp);
+        memcpy(tmp + lo, p + lo, hi - lo);
+        p = tmp;
     }
-    return c;
+    ix_kernel(p, &quote, &bs, &brk);
+    str = ix_strings(&quote, bs, hi, &in->ixesc, &in->ixstr);
+
+    w[IX_BRACKET] = brk & ~str;
+    w[IX_QUOTE]   = quote;
 }
 
 
-/* Fetch hexadecimal value
+/* Start indexing at the current position, which must not
+ * be within a string
  */
-static unsigned
-hexget(int bits, unsigned val)
+static void
+ix_start(void)
 {
-    unsigned c;
+    struct input *in = &J->in;
 
-    c = ch();
-    if ((c >= '0') && (c <= '9'))
+    ix_init();
+    if (!in->ix)
     {
-        c -= '0';
+        in->ix = alloc0(2 * IX_WORDS * sizeof *in->ix);
     }
-    else if ((c >= 'a') && (c <= 'f'))
+    in->indexed = 1;
+    in->ixlo    = in->pos >> 6;
+    in->ixhi    = in->pos >> 6;
+    in->ixstr   = 0;
+    in->ixesc   = 0;
+    in->ixfrom  = in->pos;
+}
+
+
+/* Index words of chunk c, c must not go backwards
+ */
+static const uint64_t *
+ix_word(size_t c)
+{
+    struct input *in = &J->in;
+    size_t       n   = (in->len + 63) >> 6;
+    size_t       k;
+
+    if (c >= in->ixhi)
     {
-        c -= 'a' - 10;
+        while (in->ixhi < c)
+        {
+            ix_chunk(in->ixhi++, in->ix);
+        }
+        in->ixlo = c;
+        for (k = 0; k < IX_WORDS && in->ixhi < n; k++)
+        {
+            ix_chunk(in->ixhi++, in->ix + 2 * k);
+        }
     }
-    else if ((c >= 'A') && (c <= 'F'))
+    FATAL(c < in->ixlo);
+    return in->ix + 2 * (c - in->ixlo);
+}
+
+
+/* Position of the next IX_QUOTE or IX_BRACKET bit at or after i,
+ * len if there is none in this block.
+ */
+static size_t
+ix_next(size_t i, int what)
+{
+    size_t   c   = i >> 6;
+    size_t   len = J->in.len;
+    uint64_t w;
+
+    if (i >= len)
     {
-        c -= 'A' - 10;
+        return len;
     }
-    else
+    for (w = ix_word(c)[what] & (~0ull << (i & 63)); !w; w = ix_word(c)[what])
     {
-        OOPSc(c, "hex digit expected");
+        if (++c << 6 >= len)
+        {
+            return len;
+        }
     }
-    return val | (c << bits);
+    i = (c << 6) + __builtin_ctzll(w);
+    return i < len ? i : len;
 }
 
 
-/* Fetch unicode character.
- *
- * For now we do not decompose the UTF-8 input.
- * This might change in future.
+/* The block is about to be replaced, carry the state over
  */
-static int
-uniget(char end)
+static void
+ix_flush(void)
 {
-    int c;
+    struct input *in = &J->in;
+    size_t       n   = (in->len + 63) >> 6;
+    uint64_t     w[2];
 
-    if ((c = ch()) < 0)
+    while (in->ixhi < n)
     {
-        OOPS("disallowed control character %d in JSON string", c);
+        ix_chunk(in->ixhi++, w);
     }
+    in->ixlo   = in->ixhi = 0;
+    in->ixfrom = 0;
+}
 
-    if (c == end)
-    {
-        return EOF;
-    }
 
-    if (c != '\\')
+/**********************************************************************
+ * INPUT
+ *********************************************************************/
+
+static void
+in_init(int fd)
+{
+    if (!J->in.block)
     {
-        return c;
+        J->in.block = alloc0(JSON2SH_BLOCK);
     }
+    J->in.buf     = J->in.block;
+    J->in.fd      = fd;
+    J->in.mem     = 0;
+    J->in.regular = 0;
+    J->in.close   = 0;
+    J->in.indexed = 0;
+    J->in.pos     = 0;
+    J->in.len     = 0;
+    J->in.lines   = 0;
+    J->in.col     = 0;
+}
 
-    switch (c = ch())
+
+/* strerror(), but thread-safe for the workers of -j
+ */
+static const char *
+in_strerror(int err)
+{
+    static __thread char msg[128];
+
+#if defined(__GLIBC__) && defined(_GNU_SOURCE)
+    return strerror_r(err, msg, sizeof msg);
+#else
+    if (strerror_r(err, msg, sizeof msg))
     {
-    case '"':
-        return c;
+        snprintf(msg, sizeof msg, "error %d", err);
+    }
+    return msg;
+#endif
+}
 
-    case '\\':
-        return c;
 
-    case '/':
-        return c;
+/* Count lines and columns in buf[0..end)
+ */
+static void
+in_count(size_t end, int *lines, size_t *col)
+{
+    const unsigned char *p, *e, *nl;
 
-    case 'b':
-        return '\b';
+    for (p = J->in.buf, e = J->in.buf + end; (nl = memchr(p, '\n', e - p)); p = nl + 1)
+    {
+        ++*lines;
+        *col = 0;
+    }
+    *col += e - p;
+}
 
-    case 'f':
-        return '\f';
 
-    case 'n':
-        return '\n';
+static void
+in_where(void)
+{
+    int    lines = J->in.lines;
+    size_t col   = J->in.col;
 
-    case 'r':
-        return '\r';
+    in_count(J->in.pos, &lines, &col);
+    J->line   = lines;
+    J->column = col;
+}
 
-    case 't':
-        return '\t';
 
-    case 'u':
-        break;
+/* Fetch the next block, returns 0 on EOF
+ */
+static int
+in_fill(void)
+{
+    ssize_t got;
 
-    default:
-        OOPSc(c, "unknown escape sequence");
+    if (J->in.maplen || J->in.mem)
+    {
+        return 0;
     }
-
-    return hexget(0, hexget(4, hexget(8, hexget(12, 0))));
+    if (J->in.indexed)
+    {
+        ix_flush();
+    }
+    in_count(J->in.len, &J->in.lines, &J->in.col);
+    J->in.pos = J->in.len = 0;
+    do
+    {
+        got = read(J->in.fd, J->in.buf, JSON2SH_BLOCK);
+    } while (got < 0 && errno == EINTR);
+    if (got < 0)
+    {
+        OOPS("read error: %s", in_strerror(errno));
+    }
+    J->in.len = got;
+    return got > 0;
 }
 
 
-/**********************************************************************
- * Shell variable name (base)
- *********************************************************************/
-
-enum base_type
+static int
+get(void)
 {
-    B_UNSPEC = 0,
-    B_PREFIX,
-    B_ARR,
-    B_INDEX,
-    B_OBJ,
-    B_KEY,
-    B_VAL,
-};
+    if (J->in.pos >= J->in.len && !in_fill())
+    {
+        return EOF;
+    }
+    xD("(%d %c)", J->in.buf[J->in.pos], cc(J->in.buf[J->in.pos]));
+    return J->in.buf[J->in.pos++];
+}
 
-typedef struct base *BASE;
-struct base
+
+/* Push back the character just returned by get()
+ */
+static void
+unget(void)
 {
-    /* CAVEAT!  When adding new properties here
-     * be sure to initialize them in base_new()!
-     */
-    BASE           next, top;           /* initialized	*/
-    enum base_type type;                /* initialized	*/
-    int            done;                /* initialized	*/
-    unsigned       esc, cp;             /* initialized	*/
-    int            value;               /* initialized	*/
-    int            pos;                 /* initialized	*/
-    int            buflen;              /* no initialization, taken from freelist	*/
-    char           *buf;                /* no initialization, taken from freelist	*/
-};
+    J->in.pos--;
+}
 
-static BASE base_freelist;
 
-/* We just give back to the pool.
- * No cleanups, as we can reuse the buffers later.
+/* Read FILE, or stdin if NULL.
+ * Regular files are mapped, so the lexer runs directly over the
+ * page cache.  Pipes, ttys and empty files are read in blocks.
  */
-static BASE
-base_free(BASE b)
+static int
+in_open(const char *file)
 {
-    BASE tmp = b->next;
+    struct stat st;
+    void        *map;
+    int         fd = 0;
 
-    b->next = base_freelist;
-    b->type = B_UNSPEC;
+    if (file && (fd = open(file, O_RDONLY)) < 0)
+    {
+        return -1;
+    }
+    in_init(fd);
+    if (!file)
+    {
+        return 0;
+    }
+    J->in.close = 1;
 
-    base_freelist = b;
-    return tmp;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || (st.st_size <= 0) || ((size_t)st.st_size != st.st_size))
+    {
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return 0;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    J->in.regular  = 1;
+    J->in.id.dev   = st.st_dev;
+    J->in.id.ino   = st.st_ino;
+    J->in.id.size  = st.st_size;
+    J->in.id.mtime = st.st_mtim;
+    close(fd);
+    J->in.fd    = -1;
+    J->in.close = 0;
+    J->in.buf   = map;
+    J->in.len   = J->in.maplen = st.st_size;
+    return 0;
 }
 
 
-/* Append some unicode character to our base.
- */
 static void
-base_put(BASE b, int c)
+in_close(void)
 {
-    if (b->pos >= b->buflen)
+    if (J->in.maplen)
     {
-        b->buflen += BUFSIZ;
-        b->buf     = re_alloc(b->buf, b->buflen);
+        munmap(J->in.buf, J->in.maplen);
+        J->in.maplen = 0;
     }
-    b->buf[b->pos++] = c;
-    if (b->type != B_VAL)
+    if (J->in.close)
     {
-        outc(c);
+        close(J->in.fd);
+        J->in.close = 0;
     }
+    J->in.mem = 0;
+    J->in.buf = J->in.block;
+    J->in.pos = J->in.len = 0;
 }
 
 
+/* Read from len bytes at text, which stay the caller's
+ */
 static void
-base_esc_end(BASE b)
+in_mem(unsigned char *text, size_t len)
 {
-    D("(%d)", b->esc);
-    if (b->esc)
-    {
-        base_put(b, '_');
-    }
-    b->esc = 0;
-    b->cp  = 0;
+    J->in.buf   = text;
+    J->in.pos   = 0;
+    J->in.len   = len;
+    J->in.lines = 0;
+    J->in.col   = 0;
+    J->in.mem   = 1;
+}
+
+
+/* Read all of the input into *text and continue from there.
+ * *text (initially NULL) is the caller's, also after OOPS().
+ */
+static void
+in_slurp(unsigned char **text, size_t *len)
+{
+    size_t  max = 0;
+    ssize_t got;
+
+    *len = 0;
+    if (J->in.maplen)
+    {
+        *text = re_alloc(NULL, J->in.len);
+        memcpy(*text, J->in.buf, *len = J->in.len);
+        munmap(J->in.buf, J->in.maplen);
+        J->in.maplen = 0;
+        in_mem(*text, *len);
+        return;
+    }
+    for (;;)
+    {
+        if (max - *len < JSON2SH_BLOCK)
+        {
+            max   = max ? 2 * max : JSON2SH_BLOCK;
+            *text = re_alloc(*text, max);
+        }
+        do
+        {
+            got = read(J->in.fd, *text + *len, max - *len);
+        } while (got < 0 && errno == EINTR);
+        if (got < 0)
+        {
+            OOPS("read error: %s", in_strerror(errno));
+        }
+        if (!got)
+        {
+            break;
+        }
+        *len += got;
+    }
+    in_mem(*text, *len);
+}
+
+
+static int
+next(void)
+{
+    const unsigned char *p, *e;
+
+    for (;;)
+    {
+        for (p = J->in.buf + J->in.pos, e = J->in.buf + J->in.len; (p < e) && (cls[*p] & C_SPACE); p++)
+        {
+        }
+        if (p < e)
+        {
+            J->in.pos = p + 1 - J->in.buf;
+            return *p;
+        }
+        J->in.pos = J->in.len;
+        if (!in_fill())
+        {
+            return EOF;
+        }
+    }
+}
+
+
+/* Warning: This skips whitespace	*/
+static int
+peek(void)
+{
+    int c;
+
+    if ((c = next()) != EOF)
+    {
+        unget();
+    }
+    xD("(%d %c)", c, cc(c));
+    return c;
+}
+
+
+/* Warning: This skips whitespace	*/
+static int
+have(int want)
+{
+    int c;
+
+    if (want == EOF)
+    {
+        return peek() == EOF;
+    }
+
+    if ((c = next()) != EOF)
+    {
+        if (c == want)
+        {
+            return 1;
+        }
+        unget();
+    }
+    return 0;
+}
+
+
+/* Warning: This skips whitespace on the first character	*/
+static void
+need(const char *c)
+{
+    int got;
+
+    xD("(%s)", c);
+    if ((got = next()) != (unsigned char)*c)
+    {
+        OOPS("expected '%s' but got '%c'", c, got);
+    }
+    while (*++c)
+    {
+        if ((got = get()) != *c)
+        {
+            OOPS("missing '%s', got '%c'", c, got);
+        }
+    }
+}
+
+
+/* Fetch a real character.
+ * Bail out on EOF
+ */
+static int
+ch(void)
+{
+    int c;
+
+    if ((c = get()) == EOF)
+    {
+        OOPS("unexpected EOF");
+    }
+    return c;
+}
+
+
+/* Fetch hexadecimal value
+ */
+static unsigned
+hexget(int bits, unsigned val)
+{
+    unsigned c;
+
+    c = ch();
+    if ((c >= '0') && (c <= '9'))
+    {
+        c -= '0';
+    }
+    else if ((c >= 'a') && (c <= 'f'))
+    {
+        c -= 'a' - 10;
+    }
+    else if ((c >= 'A') && (c <= 'F'))
+    {
+        c -= 'A' - 10;
+    }
+    else
+    {
+        OOPSc(c, "hex digit expected");
+    }
+    return val | (c << bits);
+}
+
+
+/* Skip to the next " \\ or control character in [p,e).
+ * Everything before it is taken by strings as is, after
+ * utf8_span() if *high got bit 7 set.
+ */
+static const unsigned char *
+str_span(const unsigned char *p, const unsigned char *e, unsigned *high)
+{
+    unsigned h = 0;
+
+#if defined (JSON2SH_X86) && defined (__SSE2__)
+    const __m128i q = _mm_set1_epi8('"'), b = _mm_set1_epi8('\\'), c = _mm_set1_epi8(0x1f);
+    __m128i       v;
+    unsigned      m;
+
+    for (; e - p >= 16; p += 16)
+    {
+        v  = _mm_loadu_si128((const __m128i *)p);
+        m  = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, q), _mm_cmpeq_epi8(v, b)),
+                                            _mm_cmpeq_epi8(_mm_max_epu8(v, c), c)));
+        h |= _mm_movemask_epi8(v) << 7;
+        if (m)
+        {
+            *high = h;
+            return p + __builtin_ctz(m);
+        }
+    }
+#endif
+    for (; (p < e) && !(cls[*p] & C_STOP); p++)
+    {
+        h |= *p;
+    }
+    *high = h;
+    return p;
+}
+
+
+/* UTF-8 lead byte c: returns the number of continuation bytes,
+ * 0 if c cannot start a sequence.  [lo,hi] is the range of the
+ * first continuation byte, which rules out overlong forms,
+ * surrogates and anything above U+10FFFF.
+ */
+static int
+utf8_lead(unsigned c, unsigned *lo, unsigned *hi)
+{
+    *lo = 0x80;
+    *hi = 0xbf;
+    if ((c < 0xc2) || (c > 0xf4))
+    {
+        return 0;
+    }
+    if (c < 0xe0)
+    {
+        return 1;
+    }
+    if (c < 0xf0)
+    {
+        if (c == 0xe0)
+        {
+            *lo = 0xa0;
+        }
+        if (c == 0xed)
+        {
+            *hi = 0x9f;
+        }
+        return 2;
+    }
+    if (c == 0xf0)
+    {
+        *lo = 0x90;
+    }
+    if (c == 0xf4)
+    {
+        *hi = 0x8f;
+    }
+    return 3;
+}
+
+
+/* Decode the sequence started by c
+ */
+static int
+utf8_get(int c)
+{
+    unsigned lo, hi;
+    int      n, cp;
+
+    if (!(n = utf8_lead(c, &lo, &hi)))
+    {
+        OOPSc(c, "invalid UTF-8");
+    }
+    for (cp = c & (0x3f >> n); n--; lo = 0x80, hi = 0xbf)
+    {
+        c = ch();
+        if ((c < lo) || (c > hi))
+        {
+            OOPSc(c, "invalid UTF-8");
+        }
+        cp = (cp << 6) | (c & 0x3f);
+    }
+    return cp;
+}
+
+
+/* Encode codepoint c into tmp, returns the length
+ */
+static int
+utf8_put(unsigned char *tmp, int c)
+{
+    int len = 0;
+
+    if (c < 0x80)
+    {
+        tmp[len++] = c;
+    }
+    else if (c < 0x800)
+    {
+        tmp[len++] = 0xc0 | (c >> 6);
+        tmp[len++] = 0x80 | (c & 0x3f);
+    }
+    else if (c < 0x10000)
+    {
+        tmp[len++] = 0xe0 | (c >> 12);
+        tmp[len++] = 0x80 | ((c >> 6) & 0x3f);
+        tmp[len++] = 0x80 | (c & 0x3f);
+    }
+    else
+    {
+        tmp[len++] = 0xf0 | (c >> 18);
+        tmp[len++] = 0x80 | ((c >> 12) & 0x3f);
+        tmp[len++] = 0x80 | ((c >> 6) & 0x3f);
+        tmp[len++] = 0x80 | (c & 0x3f);
+    }
+    return len;
+}
+
+
+/* Skip complete and valid UTF-8 in [p,e), ASCII 16 bytes at a time.
+ * Stops at the first sequence which is not, uniget() then either
+ * completes it (it crosses the buffer end) or complains.
+ */
+static const unsigned char *
+utf8_span(const unsigned char *p, const unsigned char *e)
+{
+    unsigned lo, hi;
+    int      n, i;
+
+    while (p < e)
+    {
+#if defined (JSON2SH_X86) && defined (__SSE2__)
+        while ((e - p >= 16) && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p)))
+        {
+            p += 16;
+        }
+        if (p == e)
+        {
+            break;
+        }
+#endif
+        if (*p < 0x80)
+        {
+            p++;
+            continue;
+        }
+        if (!(n = utf8_lead(*p, &lo, &hi)) || (e - p <= n) || (p[1] < lo) || (p[1] > hi))
+        {
+            break;
+        }
+        for (i = 2; i <= n; i++)
+        {
+            if ((p[i] & 0xc0) != 0x80)
+            {
+                return p;
+            }
+        }
+        p += n + 1;
+    }
+    return p;
+}
+
+
+/* The escape after a backslash
+ */
+static int
+uniesc(void)
+{
+    int      c;
+    unsigned lo;
+
+    switch (c = ch())
+    {
+    case '"':
+        return c;
+
+    case '\\':
+        return c;
+
+    case '/':
+        return c;
+
+    case 'b':
+        return '\b';
+
+    case 'f':
+        return '\f';
+
+    case 'n':
+        return '\n';
+
+    case 'r':
+        return '\r';
+
+    case 't':
+        return '\t';
+
+    case 'u':
+        break;
+
+    default:
+        OOPSc(c, "unknown escape sequence");
+    }
+
+    c = hexget(0, hexget(4, hexget(8, hexget(12, 0))));
+    if ((c < 0xd800) || (c > 0xdfff))
+    {
+        return c;
+    }
+    if ((c > 0xdbff) || (ch() != '\\') || (ch() != 'u'))
+    {
+        OOPS("unpaired surrogate in \\u escape");
+    }
+    lo = hexget(0, hexget(4, hexget(8, hexget(12, 0))));
+    if ((lo < 0xdc00) || (lo > 0xdfff))
+    {
+        OOPS("unpaired surrogate in \\u escape");
+    }
+    return 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+}
+
+
+/* Fetch unicode character.
+ *
+ * UTF-8 is decoded and \u escapes, surrogate pairs
+ * included, are returned as the codepoint.
+ */
+static int
+uniget(char end)
+{
+    int c;
+
+    if ((c = ch()) < 0)
+    {
+        OOPS("disallowed control character %d in JSON string", c);
+    }
+
+    if (c == end)
+    {
+        return EOF;
+    }
+
+    if (c >= 0x80)
+    {
+        return utf8_get(c);
+    }
+
+    if (c != '\\')
+    {
+        return c;
+    }
+
+    return uniesc();
+}
+
+
+/**********************************************************************
+ * Shell variable name (base)
+ *********************************************************************/
+
+enum base_type
+{
+    B_UNSPEC = 0,
+    B_PREFIX,
+    B_ARR,
+    B_INDEX,
+    B_OBJ,
+    B_KEY,
+    B_VAL,
+};
+
+typedef struct base *BASE;
+struct base
+{
+    /* CAVEAT!  When adding new properties here
+     * be sure to initialize them in base_new()!
+     */
+    BASE           next, top;           /* initialized	*/
+    enum base_type type;                /* initialized	*/
+    int            done;                /* initialized	*/
+    unsigned       esc, cp;             /* initialized	*/
+    int            value;               /* initialized	*/
+    int            pos;                 /* initialized	*/
+    int            sel;                 /* initialized: print all below	*/
+    unsigned       match;               /* initialized: -p still alive	*/
+    int            depth;               /* initialized: for -p	*/
+    unsigned long  gen;                 /* initialized: unique, see base_print()	*/
+    int            buflen;              /* no initialization, kept in freelist	*/
+    char           *buf;                /* no initialization, kept in freelist, in arena	*/
+};
+
+/* We just give back to the pool.
+ * No cleanups, as we can reuse the buffers later.
+ */
+static BASE
+base_free(BASE b)
+{
+    BASE tmp = b->next;
+
+    b->next = J->freelist;
+    b->type = B_UNSPEC;
+
+    J->freelist = b;
+    return tmp;
+}
+
+
+/* Append some unicode character to our base.
+ */
+static void
+base_grow(BASE b, int len)
+{
+    char *tmp;
+
+    do
+    {
+        b->buflen = b->buflen ? 2 * b->buflen : 32;
+    } while (b->buflen < len);
+    tmp = arena_alloc(b->buflen);
+    if (b->pos)
+    {
+        memcpy(tmp, b->buf, b->pos);
+    }
+    b->buf = tmp;
+}
+
+
+static void
+base_put(BASE b, int c)
+{
+    if (b->pos >= b->buflen)
+    {
+        base_grow(b, b->pos + 1);
+    }
+    b->buf[b->pos++] = c;
+}
+
+
+/* Append already escaped name bytes
+ */
+static void
+base_putn(BASE b, const char *s, int len)
+{
+    if (b->pos + len > b->buflen)
+    {
+        base_grow(b, b->pos + len);
+    }
+    if (len)
+    {
+        memcpy(b->buf + b->pos, s, len);
+    }
+    b->pos += len;
+}
+
+
+static void
+base_esc_end(BASE b)
+{
+    D("(%d)", b->esc);
+    if (b->esc)
+    {
+        base_put(b, '_');
+    }
+    b->esc = 0;
+    b->cp  = 0;
 }
 
 
 /* actually, this is a hack	*/
 static BASE
-base_child(BASE p, BASE b)
+base_child(BASE p, BASE b)
+{
+    FATAL(b->type == B_UNSPEC);
+    if (p)
+    {
+        FATAL(b == p);
+        FATAL(p->type == B_UNSPEC);
+        FATAL(p->next && p->next != b);
+        p->next = b;
+        b->top  = p->top;
+        if (b->done)    /* cannot happen, but perhaps in future	*/
+        {
+            p->done = 1;
+        }
+
+        /* finish building variable name when value node follows	*/
+        if (b->type == B_VAL)
+        {
+            base_esc_end(p);
+        }
+
+        /* copy codepage and esc mode from parent	*/
+        b->esc = p->esc;
+        b->cp  = p->cp;
+
+        /* and the selection	*/
+        b->sel   = p->sel;
+        b->match = p->match;
+        b->depth = p->depth;
+    }
+    FATAL(b->next);
+    return b;
+}
+
+
+static BASE
+base_new(BASE p, enum base_type type)
+{
+    BASE b;
+
+    FATAL(p && p->type == B_UNSPEC);
+
+    if (J->freelist)
+    {
+        b           = J->freelist;
+        J->freelist = b->next;
+    }
+    else
+    {
+        b         = arena_alloc(sizeof *b);
+        b->type   = B_UNSPEC;
+        b->buflen = 0;
+        b->buf    = NULL;
+    }
+    J->arena.nodes++;
+
+    FATAL(b->type != B_UNSPEC);
+
+    /* CAVEAT!  When adding new properties to BASE
+     * be sure to initialize them here!
+     */
+    b->next  = 0;
+    b->top   = b;
+    b->type  = type;
+    b->done  = 0;
+    b->esc   = 0;
+    b->cp    = 0;
+    b->value = 0;
+    b->pos   = 0;
+    b->sel   = 1;
+    b->match = 0;
+    b->depth = 0;
+    b->gen   = ++J->gen;
+    /* buflen and buf kept	*/
+
+    return base_child(p, b);
+}
+
+
+/* Cut the remaining base->next pointers.
+ * This is because we are lazy.
+ * We create base(parent), but we do not free it.
+ *
+ * Due to recursion, we know the sub-thing is no more needed,
+ * so we can give it back to the pool.
+ */
+static void
+base_cut(BASE p)
+{
+    BASE b;
+
+    if (p)
+    {
+        for (b = p->next; b; b = base_free(b))
+        {
+            if (b->done)
+            {
+                p->done = 1;
+            }
+        }
+        p->next = 0;
+    }
+}
+
+
+static int
+base_done(BASE b)
+{
+    base_cut(b);
+    return b->done;
+}
+
+
+/* Print out (repeat) the SHell variable name up to here.
+ * Names are only printed when a value follows, so nothing
+ * is output for parts of the input which are skipped.
+ *
+ * The name is assembled in J->path.  Node buffers only ever
+ * grow, so the levels still from the same node (gen) with the
+ * same length are kept, and only the rest is copied again.
+ */
+static void
+base_print(BASE b, const char *pre)
+{
+    struct level *l;
+    size_t       i;
+
+    D("(%p %d)", b, b->type);
+    if (J->lines++)
+    {
+        nl();
+    }
+    if (pre)
+    {
+        outn(pre, strlen(pre));
+    }
+    for (i = 0; b && (i < J->nlvl); b = b->next, i++)
+    {
+        if ((J->lvl[i].gen != b->gen) || (J->lvl[i].pos != b->pos))
+        {
+            break;
+        }
+    }
+    J->path.len = i ? J->lvl[i - 1].off + J->lvl[i - 1].pos : 0;
+    for ( ; b; b = b->next, i++)
+    {
+        if (i >= J->lvlmax)
+        {
+            J->lvlmax = J->lvlmax * 2 + 16;
+            J->lvl    = re_alloc(J->lvl, J->lvlmax * sizeof *J->lvl);
+        }
+        l      = &J->lvl[i];
+        l->gen = b->gen;
+        l->pos = b->pos;
+        l->off = J->path.len;
+        buf_add(&J->path, b->buf, b->pos);
+    }
+    J->nlvl = i;
+    outn(J->path.buf, J->path.len);
+}
+
+
+/* Setup for a new value to print out
+ */
+static BASE
+base(BASE p, enum base_type type)
+{
+    D("(%p t=%d)", p, type);
+    base_cut(p);
+    return base_new(p, type);
+}
+
+
+/* The name is complete, print it, with pre in front of it
+ */
+static void
+base_fin_pre(BASE b, const char *pre)
+{
+    base_esc_end(b);
+    if (!b->done && !J->elem)
+    {
+        base_print(b->top, J->bind_mode ? NULL : pre);
+        if (!J->bind_mode)
+        {
+            outb(&J->sep);
+        }
+    }
+    b->done = 1;
+}
+
+
+static void
+base_fin(BASE b)
+{
+    base_fin_pre(b, NULL);
+}
+
+
+static void
+base_out(BASE b, const char *s, ...)
+{
+    va_list list;
+
+    va_start(list, s);
+    vout(s, list);
+    va_end(list);
+}
+
+
+/* bind_mode: assign the value to the name collected so far.
+ */
+static SHELL_VAR *
+base_bind(const char *val)
+{
+    struct sink *o = &J->out;
+    SHELL_VAR   *v;
+
+    if (J->elem)
+    {
+        outn(val, strlen(val) + 1);
+        return NULL;
+    }
+    sink_need(o, 1);
+    o->buf[o->len] = 0;
+    if (!legal_identifier(o->buf))
+    {
+        OOPS("'%s' is not a valid identifier", o->buf);
+    }
+    v = bind_variable(o->buf, (char *)val, 0);
+    if (J->stream)
+    {
+        buf_add(&J->bound, o->buf, o->len + 1);
+    }
+    return v;
+}
+
+
+/* Bind the name in J->out to an associative array of the
+ * len bytes of NUL terminated KEY and VALUE pairs.
+ */
+static void
+base_bind_assoc(const char *vals, size_t len)
+{
+    struct sink *o = &J->out;
+    SHELL_VAR   *v;
+    const char  *p, *val;
+
+    sink_need(o, 1);
+    o->buf[o->len] = 0;
+    if (!legal_identifier(o->buf))
+    {
+        OOPS("'%s' is not a valid identifier", o->buf);
+    }
+    if ((v = find_variable(o->buf)) && readonly_p(v))
+    {
+        OOPS("%s: readonly variable", o->buf);
+    }
+    unbind_variable(o->buf);
+    v = make_new_assoc_variable(o->buf);
+    for (p = vals; p < vals + len; p = val + strlen(val) + 1)
+    {
+        val = p + strlen(p) + 1;
+        assoc_insert(assoc_cell(v), savestring(p), (char *)val);     /* takes the key	*/
+    }
+    if (J->stream)
+    {
+        buf_add(&J->bound, o->buf, o->len + 1);
+    }
+}
+
+
+/* Bind the name in J->out to an indexed array of the
+ * len bytes of NUL terminated vals.
+ */
+static void
+base_bind_array(const char *vals, size_t len)
+{
+    struct sink *o = &J->out;
+    SHELL_VAR   *v;
+    const char  *p;
+    arrayind_t  i;
+
+    sink_need(o, 1);
+    o->buf[o->len] = 0;
+    if (!legal_identifier(o->buf))
+    {
+        OOPS("'%s' is not a valid identifier", o->buf);
+    }
+    if ((v = find_variable(o->buf)) && readonly_p(v))
+    {
+        OOPS("%s: readonly variable", o->buf);
+    }
+    unbind_variable(o->buf);
+    v = make_new_array_variable(o->buf);
+    for (p = vals, i = 0; p < vals + len; p += strlen(p) + 1, i++)
+    {
+        array_insert(array_cell(v), i, (char *)p);
+    }
+    if (J->stream)
+    {
+        buf_add(&J->bound, o->buf, o->len + 1);
+    }
+}
+
+
+/* Constants are output as $JSON_true_ and the like.
+ * In bind_mode we do what eval would do with this.
+ */
+static void
+base_const(BASE b, const char *var)
+{
+    char name[40];
+    char *val;
+
+    if (!J->bind_mode)
+    {
+        base_out(b, J->elem ? "\"$JSON_%s_\"" : "$JSON_%s_", var);   /* no word splitting in (..)	*/
+        return;
+    }
+    snprintf(name, sizeof name, "JSON_%s_", var);
+    val = get_string_value(name);
+    base_bind(val ? val : "");
+}
+
+
+/* Send character, perhaps switching in esc mode:
+ * 0: plain characters (0-9 A-Z a-z)
+ * 1: indexes (1-999999999999999999999)
+ * 2: object separator _0_
+ * 3: all other escapes
+ */
+static void
+base_esc(BASE b, int c, int esc)
+{
+    if ((b->esc != esc) && ((b->esc & esc) == 0))
+    {
+        base_esc_end(b);
+        if (esc)
+        {
+            base_put(b, '_');
+        }
+    }
+    b->esc = esc;
+    base_put(b, c);
+}
+
+
+/* literal output (variable name)
+ */
+static void
+base_set(BASE b, struct _buf *buf)
+{
+    int i;
+
+    for (i = 0; i < buf->len; i++)
+    {
+        base_esc(b, buf->buf[i], 0);
+    }
+}
+
+
+static BASE
+base_index(BASE p, int index)
+{
+    BASE b = base(p, B_INDEX);
+    char buf[200], *ptr;
+
+    base_esc_end(b);
+    snprintf(buf, sizeof buf, "%d", index);
+    for (ptr = buf; *ptr; )
+    {
+        base_esc(b, *ptr++, 1);
+    }
+    return b;
+}
+
+
+static void
+base_hex(BASE b, int hex)
+{
+    base_esc(b, "zyxwusqpomlkjihg"[hex & 0xf], 3);
+}
+
+
+static void
+base_cp26(BASE b, unsigned cp)
+{
+    if (cp > 25)
+    {
+        base_cp26(b, cp / 26);
+    }
+    base_esc(b, "ABCDEFGHIJKLMNOPQRSTUVWXYZ"[cp % 26], 3);
+}
+
+
+static void
+base_cp(BASE b, unsigned cp)
+{
+    if (b->cp == cp)
+    {
+        return;
+    }
+
+    b->cp = cp;
+    base_cp26(b, cp);
+}
+
+
+static int
+simple_value(int ch)
+{
+    return CLS(ch, C_NAME);
+}
+
+
+static void
+base_escape(BASE b, int ch)
+{
+    switch (ch)
+    {
+    case EOF:
+        return;
+
+    case '_':
+        /* perhaps delay a bit, to see if we enter or leave ->esc	*/
+        if (b->esc)
+        {
+            base_esc(b, 'c', 3);
+        }
+        else
+        {
+            base_esc(b, ch, 0);
+            base_esc(b, ch, 0);
+        }
+        return;
+    }
+
+    if (((unsigned)ch < 256) && esc_name[ch])
+    {
+        base_esc(b, esc_name[ch], 3);
+        return;
+    }
+    if (simple_value(ch))
+    {
+        base_esc(b, ch, 0);
+        return;
+    }
+
+    base_cp(b, ch >> 8);
+    base_hex(b, ch >> 4);
+    base_hex(b, ch);
+}
+
+
+/* Store the value unquoted, for bind_mode.
+ * Codepoints are stored as UTF-8.
+ */
+static void
+base_raw(BASE b, int ch)
+{
+    unsigned char tmp[4];
+
+    if (ch == EOF)
+    {
+        base_put(b, 0);
+        base_bind(b->buf);
+        b->pos--;
+        return;
+    }
+    if (ch < 0x80)
+    {
+        base_put(b, ch);
+        return;
+    }
+    base_putn(b, (const char *)tmp, utf8_put(tmp, ch));
+}
+
+
+/* base_add() for a run of bytes, which uniget() would
+ * have returned unchanged.  Buffered bytes are copied in spans,
+ * and in $'..' only the bytes which need it are escaped.
+ */
+static void
+base_addn(BASE b, const unsigned char *s, size_t n)
+{
+    const unsigned char *e = s + n, *lim, *q;
+    int                 i;
+
+    if (J->bind_mode)
+    {
+        base_putn(b, (const char *)s, n);
+        return;
+    }
+    if (b->value < 2)
+    {
+        lim = s + (n < 255 - b->pos ? n : 255 - b->pos);
+        if (b->value == 0)
+        {
+            for (q = s; (q < lim) && (cls[*q] & C_NAME); q++)
+            {
+            }
+            base_putn(b, (const char *)s, q - s);
+            s = q;
+            if (s < lim)
+            {
+                b->value = 1;
+            }
+        }
+        if (b->value == 1)
+        {
+            for (q = s; (q < lim) && (cls[*q] & C_QUOTED); q++)
+            {
+            }
+            base_putn(b, (const char *)s, q - s);
+            s = q;
+        }
+        if (s == e)
+        {
+            return;
+        }
+        outn("$'", 2);
+        for (i = 0; i < b->pos; i++)
+        {
+            oute((unsigned char)b->buf[i]);
+        }
+        b->value = 3;
+    }
+    while (s < e)
+    {
+        for (q = s; (q < e) && (cls[*q] & C_QUOTED) && !esc_ansi[*q]; q++)
+        {
+        }
+        outn((const char *)s, q - s);
+        if ((s = q) < e)
+        {
+            oute(*s++);
+        }
+    }
+}
+
+
+/* Codepoints above ASCII are output as UTF-8, like they came
+ */
+static void
+base_add(BASE b, int ch)
+{
+    unsigned char tmp[4];
+
+    if (J->bind_mode)
+    {
+        base_raw(b, ch);
+        return;
+    }
+    if (ch >= 0x80)
+    {
+        base_addn(b, tmp, utf8_put(tmp, ch));
+        return;
+    }
+    if (ch == EOF)
+    {
+        switch (b->value)
+        {
+        case 0:
+            outn(b->buf, b->pos);
+            return;
+
+        case 1:
+            outc('\'');
+            outn(b->buf, b->pos);
+
+        default:
+            outc('\'');
+            return;
+        }
+    }
+    if ((b->value < 2) && (b->pos < 255))
+    {
+        if (((b->value == 0) && simple_value(ch)) || (b->value = 1, CLS(ch, C_QUOTED)))
+        {
+            base_put(b, ch);
+            return;
+        }
+    }
+    if (b->value < 3)
+    {
+        int i;
+
+        outn("$'", 2);
+        for (i = 0; i < b->pos; i++)
+        {
+            oute((unsigned char)b->buf[i]);
+        }
+    }
+    b->value = 3;
+    oute(ch);
+}
+
+
+/* Number grammar, st is the state after what was seen:
+ * 0 nothing, 1 -, 2 leading 0, 3 integer digits, 4 ., 5 fraction
+ * digits, 6 e, 7 exponent sign, 8 exponent digits.
+ * Returns the next state, -1 if c does not continue the number.
+ */
+static int
+num_next(int st, int c)
+{
+    int digit = (c >= '0') && (c <= '9');
+
+    switch (st)
+    {
+    case 0:
+        if (c == '-')
+        {
+            return 1;
+        }
+    /* FALLTHROUGH */
+    case 1:
+        return c == '0' ? 2 : digit ? 3 : -1;
+
+    case 3:
+        if (digit)
+        {
+            return 3;
+        }
+    /* FALLTHROUGH */
+    case 2:
+        return c == '.' ? 4 : (c == 'e') || (c == 'E') ? 6 : -1;
+
+    case 4:
+        return digit ? 5 : -1;
+
+    case 5:
+        return digit ? 5 : (c == 'e') || (c == 'E') ? 6 : -1;
+
+    case 6:
+        if ((c == '+') || (c == '-'))
+        {
+            return 7;
+        }
+    /* FALLTHROUGH */
+    case 7:
+    case 8:
+        return digit ? 8 : -1;
+    }
+    return -1;
+}
+
+
+/* Scan a number directly in the input buffer and copy it
+ * to J->num in one go (per block), NUL terminated.
+ * Returns 1 for an integer, 0 if it has a fraction or exponent.
+ */
+static int
+num_scan(void)
+{
+    const unsigned char *p, *s, *e;
+    int                 st = 0, nx;
+
+    J->num.len = 0;
+    for (;;)
+    {
+        for (s = p = J->in.buf + J->in.pos, e = J->in.buf + J->in.len; p < e; p++)
+        {
+            if ((nx = num_next(st, *p)) < 0)
+            {
+                break;
+            }
+            st = nx;
+        }
+        buf_add(&J->num, (const char *)s, p - s);
+        J->in.pos = p - J->in.buf;
+        if ((p < e) || !in_fill())
+        {
+            break;
+        }
+    }
+    buf_add(&J->num, "", 1);
+    J->num.len--;
+
+    if ((st != 2) && (st != 3) && (st != 5) && (st != 8))
+    {
+        OOPS("number expected");
+    }
+    return st <= 3;
+}
+
+
+/**********************************************************************
+ * Selection (-p)
+ *********************************************************************/
+
+/* Add a selector:
+ *	/a/0/b~1c	JSON Pointer, exact names, ~1 is / and ~0 is ~
+ *	a.*.b\.c	dotted path, fnmatch(3) globs, \ quotes
+ * Array indexes count from 0 in both.  "" selects everything.
+ */
+static int
+path_add(const char *s)
+{
+    struct path *p;
+    char        *seg;
+    size_t      len;
+    int         ptr = *s == '/';
+    char        sep = ptr ? '/' : '.';
+
+    if (J->npaths >= JSON2SH_PATHS)
+    {
+        return -1;
+    }
+    p       = &J->paths[J->npaths++];
+    p->glob = !ptr;
+    p->nseg = 0;
+    p->seg  = alloc0((strlen(s) + 1) * sizeof *p->seg);
+    if (*s == sep)
+    {
+        s++;
+    }
+    if (!ptr && !*s)
+    {
+        return 0;
+    }
+
+    do
+    {
+        seg = p->seg[p->nseg++] = alloc0(strlen(s) + 1);
+        for (len = 0; *s && *s != sep; s++)
+        {
+            if (ptr && (*s == '~') && ((s[1] == '0') || (s[1] == '1')))
+            {
+                seg[len++] = *++s == '0' ? '~' : '/';
+            }
+            else if (!ptr && (*s == '\\') && ((s[1] == '.') || (s[1] == '\\')))
+            {
+                seg[len++] = *++s;
+            }
+            else
+            {
+                seg[len++] = *s;
+            }
+        }
+    } while (*s++);
+    return 0;
+}
+
+
+static void
+path_free(void)
+{
+    int i, j;
+
+    for (i = 0; i < J->npaths; i++)
+    {
+        for (j = 0; j < J->paths[i].nseg; j++)
+        {
+            free(J->paths[i].seg[j]);
+        }
+        free(J->paths[i].seg);
+    }
+    J->npaths = 0;
+}
+
+
+/* Setup the root: everything is selected without -p
+ */
+static void
+path_root(BASE b)
+{
+    int i;
+
+    b->sel   = !J->npaths;
+    b->match = 0;
+    b->depth = 0;
+    for (i = 0; i < J->npaths; i++)
+    {
+        if (!J->paths[i].nseg)
+        {
+            b->sel = 1;
+        }
+        b->match |= 1u << i;
+    }
+}
+
+
+/* Collect a key character as it came from uniget()
+ */
+static void
+key_int(int c)
+{
+    if (J->keyn >= J->keymax)
+    {
+        J->keymax = J->keymax * 2 + 64;
+        J->keyv   = re_alloc(J->keyv, J->keymax * sizeof *J->keyv);
+    }
+    J->keyv[J->keyn++] = c;
+}
+
+
+/* and also as UTF-8
+ */
+static void
+key_put(int c)
+{
+    unsigned char tmp[4];
+
+    key_int(c);
+    buf_add(&J->key, (const char *)tmp, utf8_put(tmp, c));
+}
+
+
+/* t is the child of p named name (key or index).
+ * Returns 0 if no -p can match in t, so it can be skipped.
+ */
+static int
+base_select(BASE p, BASE t, const char *name)
+{
+    struct path *path;
+    int         i;
+
+    t->sel   = 0;
+    t->match = 0;
+    t->depth = p->depth + 1;
+    for (i = 0; i < J->npaths; i++)
+    {
+        path = &J->paths[i];
+        if (!(p->match & (1u << i)) || (path->nseg <= p->depth))
+        {
+            continue;
+        }
+        if (path->glob ? fnmatch(path->seg[p->depth], name, 0) : strcmp(path->seg[p->depth], name))
+        {
+            continue;
+        }
+        if (path->nseg == t->depth)
+        {
+            t->sel = 1;
+        }
+        else
+        {
+            t->match |= 1u << i;
+        }
+    }
+    return t->sel || t->match;
+}
+
+
+/* skip_value() for a string or container, using the index:
+ * strings end at the next quote, containers when the brackets
+ * balance.
+ */
+static void
+skip_indexed(void)
+{
+    size_t i     = J->in.pos;
+    int    what  = J->in.buf[i] == '"' ? IX_QUOTE : IX_BRACKET;
+    int    depth = 0;
+
+    if (what == IX_QUOTE)
+    {
+        i++;
+    }
+    for (;;)
+    {
+        for (i = ix_next(i, what); i < J->in.len; i = ix_next(i + 1, what))
+        {
+            if ((what == IX_BRACKET) && ((J->in.buf[i] == '{') || (J->in.buf[i] == '[')))
+            {
+                depth++;
+            }
+            else if (--depth <= 0)
+            {
+                J->in.pos = i + 1;
+                return;
+            }
+        }
+        J->in.pos = J->in.len;
+        if (!in_fill())
+        {
+            OOPS("unexpected EOF");
+        }
+        i = 0;
+    }
+}
+
+
+/* Skip the value which follows without looking at it closely.
+ * Only strings and the nesting of brackets are followed,
+ * no BASE nodes are created and nothing is escaped.
+ */
+static void
+skip_value(void)
+{
+    const unsigned char *p, *e;
+    int                 depth = 0, str = 0, esc = 0;
+
+    if ((peek() != '{') && (peek() != '[') && (peek() != '"'))
+    {
+        /* number or constant, ends at whitespace , ] }	*/
+        for (;;)
+        {
+            for (p = J->in.buf + J->in.pos, e = J->in.buf + J->in.len; p < e; p++)
+            {
+                if (cls[*p] & C_END)
+                {
+                    J->in.pos = p - J->in.buf;
+                    return;
+                }
+            }
+            J->in.pos = J->in.len;
+            if (!in_fill())
+            {
+                return;
+            }
+        }
+    }
+
+    if (J->in.indexed)
+    {
+        skip_indexed();
+        return;
+    }
+
+    for (;;)
+    {
+        for (p = J->in.buf + J->in.pos, e = J->in.buf + J->in.len; p < e; p++)
+        {
+            if (str)
+            {
+                if (esc)
+                {
+                    esc = 0;
+                }
+                else if (*p == '\\')
+                {
+                    esc = 1;
+                }
+                else if (*p == '"')
+                {
+                    str = 0;
+                    if (!depth)
+                    {
+                        J->in.pos = p + 1 - J->in.buf;
+                        return;
+                    }
+                }
+                continue;
+            }
+            switch (*p)
+            {
+            case '"':
+                str = 1;
+                break;
+
+            case '{':
+            case '[':
+                depth++;
+                break;
+
+            case '}':
+            case ']':
+                if (--depth <= 0)
+                {
+                    J->in.pos = p + 1 - J->in.buf;
+                    return;
+                }
+                break;
+            }
+        }
+        J->in.pos = J->in.len;
+        if (!in_fill())
+        {
+            OOPS("unexpected EOF");
+        }
+    }
+}
+
+
+/**********************************************************************
+ * JSON helpers
+ *********************************************************************/
+
+/* if b!=NULL then assemble a string suitable for shell variable,
+ * else assemble a string suitable for shell variable content.
+ */
+static BASE
+get_string(BASE p)
+{
+    BASE                b = base(p, B_VAL);
+    const unsigned char *s, *e, *q;
+    unsigned            hi;
+    int                 c;
+
+    base_fin(b);
+    D("");
+    need("\"");
+    for (;;)
+    {
+        /* whole runs up to the next " \\ or control	*/
+        s = J->in.buf + J->in.pos;
+        e = J->in.buf + J->in.len;
+        q = str_span(s, e, &hi);
+        if (hi & 0x80)
+        {
+            q = utf8_span(s, q);
+        }
+        if (q > s)
+        {
+            base_addn(b, s, q - s);
+            J->in.pos = q - J->in.buf;
+        }
+        if ((c = uniget('"')) == EOF)
+        {
+            break;
+        }
+        base_add(b, c);
+    }
+    base_add(b, EOF);
+    D(" ret");
+
+    return b;
+}
+
+
+/* Escape the key in J->keyv into b.
+ * Arrays of objects repeat the same few keys over and over,
+ * so the result is remembered in a direct mapped cache.
+ */
+static void
+get_key_name(BASE b)
+{
+    struct keyent *e;
+    unsigned      h   = 2166136261u ^ b->esc ^ (b->cp << 2);
+    int           pos = b->pos;
+    size_t        i, len = J->keyn * sizeof *J->keyv;
+
+    for (i = 0; i < J->keyn; i++)
+    {
+        h = (h ^ J->keyv[i]) * 16777619u;
+    }
+    if (!J->keys)
+    {
+        J->keys = alloc0(JSON2SH_KEYS * sizeof *J->keys);
+    }
+    e = &J->keys[h & (JSON2SH_KEYS - 1)];
+
+    if ((e->hash == h) && (e->esc == b->esc) && (e->cp == b->cp) && (e->raw.len == len) && !memcmp(e->raw.buf, J->keyv, len))
+    {
+        J->keyhits++;
+        base_putn(b, e->name.buf, e->name.len);
+        b->esc = e->esc2;
+        b->cp  = e->cp2;
+        return;
+    }
+
+    J->keymisses++;
+    e->hash = h;
+    e->esc  = b->esc;
+    e->cp   = b->cp;
+    for (i = 0; i < J->keyn; i++)
+    {
+        base_escape(b, J->keyv[i]);
+    }
+    base_escape(b, EOF);
+
+    e->raw.len  = 0;    /* as len > 0 this never matches	*/
+    e->name.len = 0;
+    if (J->keyn > JSON2SH_KEYLEN)
+    {
+        return;
+    }
+    buf_add(&e->raw, (const char *)J->keyv, len);
+    buf_add(&e->name, b->buf + pos, b->pos - pos);
+    e->esc2 = b->esc;
+    e->cp2  = b->cp;
+}
+
+
+/* With -p (p not selected) the key is only collected,
+ * get_key_name() does the escaping if it is needed.
+ */
+static BASE
+get_key(BASE p)
+{
+    BASE b = base(p, B_KEY);
+    int  c;
+
+    need("\"");
+    J->keyn = 0;
+    if (!p->sel || J->assoc)    /* -A: j_pair() wants it raw	*/
+    {
+        J->key.len = 0;
+        while ((c = uniget('"')) != EOF)
+        {
+            key_put(c);
+        }
+        buf_add(&J->key, "", 1);
+        return b;
+    }
+    while ((c = uniget('"')) != EOF)
+    {
+        key_int(c);
+    }
+    get_key_name(b);
+
+    return b;
+}
+
+
+/**********************************************************************
+ * JSON datatypes
+ *********************************************************************/
+
+static void
+j_string(BASE b)
+{
+    D("");
+    FATAL(b->next);
+    get_string(b);
+    D(" ret");
+}
+
+
+static void
+j_const(BASE b, const char *var)
+{
+    D("var=%s", var);
+    need(var);
+    base_fin(b);
+    base_const(b, var);
+}
+
+
+/* Push the object or array b on the stack
+ */
+static struct frame *
+j_push(BASE b, int obj)
+{
+    struct frame *f;
+
+    if (J->depth >= J->stackmax)
+    {
+        J->stack = re_alloc(J->stack, (J->stackmax ? 2 * J->stackmax : 64) * sizeof *J->stack);
+        memset(J->stack + J->stackmax, 0, (J->stackmax ? J->stackmax : 64) * sizeof *J->stack);
+        J->stackmax = J->stackmax ? 2 * J->stackmax : 64;
+    }
+    f          = &J->stack[J->depth++];
+    f->b       = b;
+    f->n       = 0;
+    f->obj     = obj;
+    f->scalars = !obj && J->arrays && b->sel;
+    f->assoc   = obj && J->assoc && b->sel;
+    f->ref     = J->ref;
+    J->ref     = 0;
+    if (f->scalars || f->assoc)
+    {
+        sink_init(&f->vals, SINK_MEM, -1, NULL);
+    }
+    return f;
+}
+
+
+/* Open an object or array below p, pushing it on the stack.
+ * The members are read by j_member().
+ */
+static void
+j_open(BASE p, int obj)
+{
+    BASE b = base(p, obj ? B_OBJ : B_ARR);
+
+    D("(%d)", obj);
+    if (J->depth >= J->maxdepth)
+    {
+        OOPS("nested deeper than %d", J->maxdepth);
+    }
+    if (obj && (p->type != B_INDEX))
+    {
+        base_esc(b, '0', 2);
+    }
+    need(obj ? "{" : "[");
+    j_push(b, obj);
+}
+
+
+/* Next member of the container on top of the stack.
+ * Returns the node its value goes to, NULL at the closing bracket.
+ * Members not wanted by -p are skipped here.
+ */
+static BASE
+j_member(struct frame *f)
+{
+    BASE b = f->b;
+    BASE t;
+    char name[24];
+
+    while (!have(f->obj ? '}' : ']'))
+    {
+        if (f->n)
+        {
+            need(",");
+        }
+        if (f->obj)
+        {
+            f->n++;
+            t = get_key(b);
+            need(":");
+            FATAL(t->next);
+            if (b->sel)
+            {
+                return t;
+            }
+            if (base_select(b, t, J->key.buf))
+            {
+                get_key_name(t);
+                return t;
+            }
+        }
+        else
+        {
+            t = base_index(b, ++f->n);
+            if (b->sel)
+            {
+                return t;
+            }
+            snprintf(name, sizeof name, "%d", f->n - 1);
+            if (base_select(b, t, name))
+            {
+                return t;
+            }
+        }
+        skip_value();
+    }
+    return NULL;
+}
+
+
+/* Output s as one shell word
+ */
+static void
+outq(const char *s)
+{
+    const char *p;
+
+    for (p = s; *p && CLS((unsigned char)*p, C_NAME); p++);
+    if (!*p && (p != s))
+    {
+        outn(s, p - s);
+        return;
+    }
+    for (p = s; *p && CLS((unsigned char)*p, C_QUOTED); p++);
+    if (!*p)
+    {
+        outc('\'');
+        outn(s, p - s);
+        outc('\'');
+        return;
+    }
+    outn("$'", 2);
+    for (p = s; *p; p++)
+    {
+        oute((unsigned char)*p);
+    }
+    outc('\'');
+}
+
+
+/* -a, -A: output what was collected in f->vals
+ * as NAME=(V1 V2 ..) or declare -gA NAME=([KEY]=VALUE ..)
+ */
+static void
+j_collected(struct frame *f)
+{
+    BASE       b = f->b;
+    const char *p, *e;
+
+    if (f->scalars)
+    {
+        base_esc_end(b);
+    }
+    base_print(b->top, f->assoc && !J->bind_mode ? "declare -gA " : NULL);
+    if (J->bind_mode)
+    {
+        (f->assoc ? base_bind_assoc : base_bind_array)(f->vals.buf, f->vals.len);
+        return;
+    }
+    outb(&J->sep);
+    outc('(');
+    for (p = f->vals.buf, e = p + f->vals.len; p < e; p += strlen(p) + 1)
+    {
+        if (p != f->vals.buf)
+        {
+            outc(' ');
+        }
+        if (f->assoc)
+        {
+            outc('[');
+            outq(p);
+            outn("]=", 2);
+            p += strlen(p) + 1;
+        }
+        if (*p)
+        {
+            outn(p, strlen(p));
+        }
+        else
+        {
+            outn("''", 2);              /* an empty word would be dropped	*/
+        }
+    }
+    outc(')');
+}
+
+
+/* -A: give the parent the name of b, to find it by.  Unless b
+ * became one variable its key is taken back, the members are
+ * output as usual.
+ */
+static void
+j_ref(struct frame *f, int var)
+{
+    struct sink *o = &f[-1].vals;
+    BASE        b;
+
+    if (!var)
+    {
+        o->len--;
+        while (o->len && o->buf[o->len - 1])
+        {
+            o->len--;
+        }
+        return;
+    }
+    if (!f->obj)
+    {
+        base_esc_end(f->b);
+    }
+    for (b = f->b->top; b; b = b->next)
+    {
+        if (b->pos)
+        {
+            sink_need(o, b->pos);
+            memcpy(o->buf + o->len, b->buf, b->pos);
+            o->len += b->pos;
+        }
+    }
+    sink_need(o, 1);
+    o->buf[o->len++] = 0;
+}
+
+
+/* The closing bracket was read, pop the container
+ */
+static void
+j_close(struct frame *f)
+{
+    BASE b   = f->b;
+    int  var = 1;
+
+    if ((f->scalars && f->vals.len) || f->assoc)
+    {
+        base_done(b);
+        j_collected(f);
+    }
+    else if (!base_done(b) && b->sel)
+    {
+        base_fin(b);
+        base_const(b, f->obj ? "nothing" : "empty");
+    }
+    else
+    {
+        var = 0;                        /* the members only	*/
+    }
+    if (f->ref)
+    {
+        j_ref(f, var);
+    }
+    J->depth--;
+}
+
+
+/* With -i integers which fit intmax_t get the integer attribute
+ */
+static void
+j_number(BASE p)
+{
+    BASE      b = base(p, B_VAL);
+    SHELL_VAR *v;
+    char      *end;
+    int       typed;
+
+    D("()");
+    typed = num_scan() && J->integers && !J->elem;
+    if (typed)
+    {
+        errno = 0;
+        strtoimax(J->num.buf, &end, 10);
+        typed = !errno && !*end;        /* all of it, in range	*/
+    }
+    base_fin_pre(b, typed ? "declare -gi " : NULL);
+
+    if (J->bind_mode)
+    {
+        if ((v = base_bind(J->num.buf)) && typed)
+        {
+            VSETATTR(v, att_integer);
+        }
+        return;
+    }
+
+    /* like base_add() would do	*/
+    if (J->num.len > 255)
+    {
+        outn("$'", 2);
+        outn(J->num.buf, J->num.len);
+        outc('\'');
+    }
+    else if (strspn(J->num.buf, "0123456789eE") == J->num.len)
+    {
+        outn(J->num.buf, J->num.len);
+    }
+    else
+    {
+        outc('\'');
+        outn(J->num.buf, J->num.len);
+        outc('\'');
+    }
+    D(" ret");
+}
+
+
+/* Start parsing the value for b: scalars are done,
+ * containers are opened.
+ */
+static void
+j_start(BASE b)
+{
+    D("()");
+    if (!b->sel && (peek() != '{') && (peek() != '['))
+    {
+        skip_value();   /* a -p wants something below	*/
+        return;
+    }
+    switch (peek())
+    {
+    case EOF:
+        OOPS("unexpected EOF");
+
+    case '{':
+        j_open(b, 1);
+        break;
+
+    case '[':
+        j_open(b, 0);
+        break;
+
+    case '"':
+        j_string(b);
+        break;
+
+    case 't':
+        j_const(b, "true");
+        break;
+
+    case 'f':
+        j_const(b, "false");
+        break;
+
+    case 'n':
+        j_const(b, "null");
+        break;
+
+    default:
+        j_number(b);
+        break;
+    }
+    D(" ret");
+}
+
+
+/* Values of -a and -A are not printed but collected in
+ * f->vals, by swapping it with J->out.
+ */
+static void
+elem_swap(struct frame *f)
+{
+    struct sink tmp = J->out;
+
+    J->out  = f->vals;
+    f->vals = tmp;
+    J->elem = J->elem ? NULL : f;
+}
+
+
+/* Parse the scalar value for b into f->vals
+ */
+static void
+elem_collect(struct frame *f, BASE b)
+{
+    elem_swap(f);
+    j_start(b);
+    if (!J->bind_mode)
+    {
+        outc(0);
+    }
+    elem_swap(f);
+}
+
+
+/* b is a member of the -a array f.  Returns NULL if it was
+ * collected, else b: it is a container, so f is output as usual
+ * from now on.  The values collected so far are printed first.
+ */
+static BASE
+j_element(struct frame *f, BASE b)
+{
+    const char *p, *e;
+    BASE       t;
+    int        i;
+
+    if ((peek() != '{') && (peek() != '['))
+    {
+        elem_collect(f, b);
+        return NULL;
+    }
+
+    f->scalars = 0;
+    for (p = f->vals.buf, e = p + f->vals.len, i = 1; p < e; p += strlen(p) + 1, i++)
+    {
+        t = base(base_index(f->b, i), B_VAL);
+        base_fin(t);
+        if (J->bind_mode)
+        {
+            base_bind(p);
+        }
+        else
+        {
+            outn(p, strlen(p));
+        }
+    }
+    return base_index(f->b, f->n);
+}
+
+
+/* b is the member of the -A object f with the key in J->key.
+ * Scalars are collected and NULL is returned.  Else b gets its
+ * name and is returned.  For a container the key is collected,
+ * j_ref() adds its name as the value.  Bash cannot store an
+ * empty key, or one with a NUL, so that member is output as usual.
+ */
+static BASE
+j_pair(struct frame *f, BASE b)
+{
+    struct sink *o = &f->vals;
+    int         container = (peek() == '{') || (peek() == '[');
+
+    if ((J->key.len > 1) && !memchr(J->key.buf, 0, J->key.len - 1))
+    {
+        sink_need(o, J->key.len);
+        memcpy(o->buf + o->len, J->key.buf, J->key.len);
+        o->len += J->key.len;
+        if (!container)
+        {
+            elem_collect(f, b);
+            return NULL;
+        }
+        J->ref = 1;
+    }
+    get_key_name(b);
+    return b;
+}
+
+
+/* -l: the value for b is only skipped over, the variable
+ * decodes it when it is read
+ */
+static void
+j_lazy(BASE b)
+{
+    size_t off;
+
+    D("()");
+    if (peek() == EOF)
+    {
+        OOPS("unexpected EOF");
+    }
+    off = J->in.pos;
+    skip_value();
+    if (J->in.pos == off)
+    {
+        OOPS("unexpected '%c'", peek());
+    }
+    base_fin(b);
+    lazy_bind(off, J->in.pos - off);
+}
+
+
+/* Parse one value into b.
+ * Nesting is kept on J->stack instead of the C stack,
+ * so the depth is only limited by -d.  Containers already
+ * on the stack are left there.
+ */
+void
+j_value(BASE b)
+{
+    struct frame *f;
+    int          top = J->depth;
+
+    while (b)
+    {
+        f = J->depth ? &J->stack[J->depth - 1] : NULL;
+        if (f && f->scalars)
+        {
+            b = j_element(f, b);
+        }
+        else if (f && f->assoc)
+        {
+            b = j_pair(f, b);
+        }
+        if (b && J->lazy && f && b->sel && ((J->depth == 1) || !f->b->sel))
+        {
+            j_lazy(b);  /* a top-level member, or selected by -p	*/
+        }
+        else if (b)
+        {
+            j_start(b);
+        }
+
+        /* where the next value goes, if any	*/
+        for (b = NULL; !b && (J->depth > top); )
+        {
+            f = &J->stack[J->depth - 1];
+            if (!(b = j_member(f)))
+            {
+                j_close(f);
+            }
+        }
+    }
+}
+
+
+/**********************************************************************
+ * Records (-s)
+ *********************************************************************/
+
+/* Forget the variables of the previous record
+ */
+static void
+json2sh_unbind(void)
+{
+    char *p, *e;
+
+    for (p = J->bound.buf, e = p + J->bound.len; p < e; p += strlen(p) + 1)
+    {
+        unbind_variable(p);
+    }
+    J->bound.len = 0;
+}
+
+
+/* A record is complete: separate it from the next one,
+ * and give it to the callback.  With -v the variable only
+ * holds the current record when the callback runs.
+ * Returns the status of the callback.
+ */
+static int
+json2sh_record(unsigned long nr)
+{
+    char   *cmd;
+    size_t len;
+
+    if (!J->bind_mode)
+    {
+        outb(&J->rs);
+    }
+    if (!J->callback)
+    {
+        return 0;
+    }
+    sink_close(&J->out, 1);
+
+    len = strlen(J->callback) + 24;
+    cmd = xmalloc(len);
+    snprintf(cmd, len, "%s %lu", J->callback, nr);
+    return evalstring(cmd, NULL, SEVAL_NOHIST);        /* frees cmd	*/
+}
+
+
+/* PREFIX, SEP and LF from the arguments, and the counters
+ */
+static void
+json2sh_setup(int argc, char **argv)
+{
+    buf(&J->pref, argc > 1 ? argv[1] : "JSON_");
+    buf(&J->sep, argc > 2 ? argv[2] : "=");
+    buf(&J->lf, argc > 3 ? argv[3] : "\n");
+    arena_init(&J->arena);
+    J->keyhits   = 0;
+    J->keymisses = 0;
+}
+
+
+int
+json2sh_main(int argc, char **argv)
+{
+    BASE          b, v;
+    unsigned long nr;
+    int           ret;
+
+    if ((argc > 4) || ((argc > 1) && (argv[1][0] == '-')))
+    {
+        fprintf(stderr, "Usage: %s [PREFIX [SEP [LF]]]\n"
+                        "\t\tVersion " JSON2SH_VERSION " from "
+                                                       "\tConvert any JSON into lines readable by shell.\n"
+                                                       "\tdefault: PREFIX='JSON_' SEP='=' LF='\\n'\n"
+                                                       "\tPREFIX/SEP/LF are de-escaped if they start with '\\'.\n"
+                                                       "\t\t\\i to ignore the initial '\\'.\n"
+                                                       "\t\t\\c to ignore the rest of the string.\n"
+                                                       "\t\t\\C to copy the rest of the string as-is.\n"
+                                                       "\tExamples:\n"
+                                                       "\t\tUse $ARG from env as-is: '\\C'\"$ARG\"\n"
+                                                       "\t\tWrite ARGs like '-\\r\\n' as '\\i''-\\r\\n'\n"
+                                                       "\t\tjson2sh <<< '[ true, false, null, [], {} ]'\n"
+                , JSON2SH_NAME);
+        return 42;
+    }
+
+    json2sh_setup(argc, argv);
+    for (nr = 1; !J->stream || peek() != EOF; nr++)
+    {
+        if (J->stream && J->bind_mode)
+        {
+            json2sh_unbind();
+        }
+        J->lines = 0;
+        J->root  = b = base_new(NULL, B_PREFIX);
+        path_root(b);
+        base_set(b, &J->pref);
+        v = b;
+        if (J->nr)
+        {
+            v = base_index(base(b, B_ARR), J->nr);    /* -j: named like an element	*/
+            path_root(v);
+        }
+        J->depth = 0;
+        j_value(v);
+        if (!J->stream && (peek() != EOF))
+        {
+            OOPS("end of input expected");
+        }
+        if (base_done(b))
+        {
+            nl();
+        }
+        J->root     = NULL;
+        J->freelist = NULL;
+        arena_reset(&J->arena);        /* all nodes at once	*/
+
+        if (!J->stream)
+        {
+            break;
+        }
+        if ((ret = json2sh_record(nr)))
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+
+/**********************************************************************
+ * Output cache
+ *********************************************************************/
+
+static struct cached *cache;            /* most recently used first	*/
+static size_t        cache_bytes;
+static unsigned long cache_hits, cache_misses;
+
+static int
+ident_eq(const struct ident *a, const struct ident *b)
+{
+    return (a->dev == b->dev) && (a->ino == b->ino) && (a->size == b->size)
+           && (a->mtime.tv_sec == b->mtime.tv_sec) && (a->mtime.tv_nsec == b->mtime.tv_nsec);
+}
+
+
+/* The cap in bytes: $JSON2SH_CACHE, 0 disables the cache
+ */
+static size_t
+cache_max(void)
+{
+    char     *s = get_string_value("JSON2SH_CACHE");
+    intmax_t n;
+
+    if (!s || !legal_number(s, &n) || (n < 0))
+    {
+        return JSON2SH_CACHE_MAX;
+    }
+    return n;
+}
+
+
+static void
+cache_drop(struct cached **cp)
+{
+    struct cached *c = *cp;
+
+    *cp          = c->next;
+    cache_bytes -= c->key.len + c->out.len;
+    free(c->key.buf);
+    free(c->out.buf);
+    free(c);
+}
+
+
+/* Evict the least recently used until at most max bytes are left
+ */
+static void
+cache_trim(size_t max)
+{
+    struct cached **cp;
+
+    while (cache && (cache_bytes > max))
+    {
+        for (cp = &cache; (*cp)->next; cp = &(*cp)->next)
+        {
+        }
+        cache_drop(cp);
+    }
+}
+
+
+/* Look up the output for key of file id, a hit moves to the front.
+ * Entries of an older version of the file are dropped on the way.
+ */
+static struct cached *
+cache_get(const struct ident *id, const struct _buf *key)
+{
+    struct cached **cp, *c;
+
+    for (cp = &cache; (c = *cp); )
+    {
+        if ((c->id.dev != id->dev) || (c->id.ino != id->ino))
+        {
+            cp = &c->next;
+            continue;
+        }
+        if (!ident_eq(&c->id, id))
+        {
+            cache_drop(cp);
+            continue;
+        }
+        if ((c->key.len == key->len) && !memcmp(c->key.buf, key->buf, key->len))
+        {
+            *cp     = c->next;
+            c->next = cache;
+            cache   = c;
+            cache_hits++;
+            return c;
+        }
+        cp = &c->next;
+    }
+    cache_misses++;
+    return NULL;
+}
+
+
+static void
+cache_put(const struct ident *id, const struct _buf *key, const struct _buf *out, size_t max)
+{
+    struct cached *c;
+
+    if (key->len + out->len > max)
+    {
+        return;
+    }
+    c     = alloc0(sizeof *c);
+    c->id = *id;
+    buf_add(&c->key, key->buf, key->len);
+    buf_add(&c->out, out->buf, out->len);
+    c->next      = cache;
+    cache        = c;
+    cache_bytes += c->key.len + c->out.len;
+    cache_trim(max);
+}
+
+
+/* json2sh_main(), or the output it gave before.  Only output
+ * printed or stored with -v is cached, for mapped files and
+ * without a callback.
+ */
+static int
+cache_main(int argc, char **argv)
+{
+    struct cached *c;
+    size_t        max = cache_max();
+    int           ret;
+
+    cache_trim(max);
+    if (!max || !J->in.regular || J->bind_mode || J->callback)
+    {
+        return json2sh_main(argc, argv);
+    }
+    if ((c = cache_get(&J->in.id, &J->ckey)))
+    {
+        arena_init(&J->arena);
+        J->keyhits   = 0;
+        J->keymisses = 0;
+        outn(c->out.buf, c->out.len);
+        return 0;
+    }
+
+    J->cout.len    = 0;
+    J->out.copy    = &J->cout;
+    J->out.copymax = max;
+    ret            = json2sh_main(argc, argv);
+    if (!ret && J->out.copy && (J->cout.len + J->out.len <= max))
+    {
+        buf_add(&J->cout, J->out.buf, J->out.len);
+        cache_put(&J->in.id, &J->ckey, &J->cout, max);
+    }
+    J->out.copy = NULL;
+    return ret;
+}
+
+
+/**********************************************************************
+ * Query handles (json2sh query, get, drop)
+ *********************************************************************/
+
+static struct tape *tapes;              /* of the shell, by name	*/
+
+static void
+tape_free(struct tape *t)
+{
+    if (t)
+    {
+        free(t->name);
+        free(t->text);
+        free(t->ent);
+        free(t->open);
+        free(t);
+    }
+}
+
+
+static struct tape **
+tape_find(const char *name)
+{
+    struct tape **tp;
+
+    for (tp = &tapes; *tp && strcmp((*tp)->name, name); tp = &(*tp)->next)
+    {
+    }
+    return tp;
+}
+
+
+/* Append the entry for the value at the input position.
+ * Entries move, so containers are remembered by index.
+ */
+static uint32_t
+tape_add(struct tape *t, int type)
+{
+    struct tent *e;
+
+    if (t->n >= t->max)
+    {
+        if (t->max >= UINT32_MAX / 2)
+        {
+            OOPS("too many values");
+        }
+        t->max = t->max ? 2 * t->max : 1024;
+        t->ent = re_alloc(t->ent, t->max * sizeof *t->ent);
+    }
+    e        = &t->ent[t->n];
+    e->off   = J->in.pos;
+    e->len   = 0;
+    e->next  = t->n + 1;
+    e->n     = 0;
+    e->type  = type;
+    e->plain = 1;
+    return t->n++;
+}
+
+
+/* A string or key, checked like get_string() does
+ */
+static void
+tape_str(struct tape *t, int type)
+{
+    const unsigned char *s, *q;
+    unsigned            hi;
+    uint32_t            i;
+
+    peek();
+    i = tape_add(t, type);
+    need("\"");
+    for (;;)
+    {
+        s = J->in.buf + J->in.pos;
+        q = str_span(s, J->in.buf + J->in.len, &hi);
+        if (hi & 0x80)
+        {
+            q = utf8_span(s, q);
+        }
+        J->in.pos = q - J->in.buf;
+        if ((J->in.pos < J->in.len) && (*q == '\\'))
+        {
+            t->ent[i].plain = 0;
+        }
+        if (uniget('"') == EOF)
+        {
+            break;
+        }
+    }
+    t->ent[i].len = J->in.pos - t->ent[i].off;
+}
+
+
+/* Parse the whole input into t.  Open containers are kept
+ * in t->open, the depth is limited by -d like j_open() does.
+ */
+static void
+tape_parse(struct tape *t)
+{
+    struct tent *e;
+    uint32_t    i;
+    int         depth = 0, c;
+
+    for (;;)
+    {
+        switch (c = peek())
+        {
+        case EOF:
+            OOPS("unexpected EOF");
+
+        case '{':
+        case '[':
+            if (depth >= J->maxdepth)
+            {
+                OOPS("nested deeper than %d", J->maxdepth);
+            }
+            if (depth >= t->openmax)
+            {
+                t->openmax = t->openmax ? 2 * t->openmax : 64;
+                t->open    = re_alloc(t->open, t->openmax * sizeof *t->open);
+            }
+            t->open[depth++] = tape_add(t, c == '{' ? T_OBJ : T_ARR);
+            next();
+            break;
+
+        case '"':
+            tape_str(t, T_STR);
+            break;
+
+        default:
+            i = tape_add(t, (c == 't') || (c == 'f') || (c == 'n') ? T_CONST : T_NUM);
+            if (t->ent[i].type == T_NUM)
+            {
+                num_scan();
+            }
+            else
+            {
+                need(c == 't' ? "true" : c == 'f' ? "false" : "null");
+            }
+            t->ent[i].len = J->in.pos - t->ent[i].off;
+            break;
+        }
+
+        /* where the next value goes, closing containers on the way	*/
+        for (;;)
+        {
+            if (!depth)
+            {
+                if (peek() != EOF)
+                {
+                    OOPS("end of input expected");
+                }
+                return;
+            }
+            e = &t->ent[t->open[depth - 1]];
+            if (have(e->type == T_OBJ ? '}' : ']'))
+            {
+                e->len  = J->in.pos - e->off;
+                e->next = t->n;
+                depth--;
+                continue;
+            }
+            if (e->n++)
+            {
+                need(",");
+            }
+            if (e->type == T_OBJ)
+            {
+                tape_str(t, T_KEY);
+                need(":");
+            }
+            break;
+        }
+    }
+}
+
+
+/* Decode the string of entry e into J->key, NUL terminated
+ */
+static void
+tape_string(struct tent *e)
+{
+    unsigned char tmp[4];
+    int           c;
+
+    J->key.len = 0;
+    J->in.pos  = e->off + 1;
+    while ((c = uniget('"')) != EOF)
+    {
+        buf_add(&J->key, (const char *)tmp, utf8_put(tmp, c));
+    }
+    buf_add(&J->key, "", 1);
+}
+
+
+/* Does the name of member e match seg?
+ */
+static int
+tape_match(struct tape *t, struct tent *e, const char *seg, int glob)
+{
+    if (e->plain && !glob)
+    {
+        return (strlen(seg) == e->len - 2) && !memcmp(t->text + e->off + 1, seg, e->len - 2);
+    }
+    tape_string(e);
+    return glob ? !fnmatch(seg, J->key.buf, 0) : !strcmp(seg, J->key.buf);
+}
+
+
+/* Array index seg as printed by "%u", else -1
+ */
+static long
+tape_index(const char *seg)
 {
-    FATAL(b->type == B_UNSPEC);
-    if (p)
+    intmax_t k;
+
+    if ((*seg == '0') && seg[1])
     {
-        FATAL(b == p);
-        FATAL(p->type == B_UNSPEC);
-        FATAL(p->next && p->next != b);
-        p->next = b;
-        b->top  = p->top;
-        if (b->done)    /* cannot happen, but perhaps in future	*/
+        return -1;
+    }
+    return (strspn(seg, "0123456789") == strlen(seg)) && legal_number(seg, &k) && (k <= UINT32_MAX) ? k : -1;
+}
+
+
+/* The entry at path from segment d on, below entry i, which is
+ * matched like -p does.  Globs may match several members, each is
+ * tried in turn, so the first match in the input wins.  Returns -1
+ * if there is none.
+ */
+static long
+tape_lookup(struct tape *t, struct path *path, int d, uint32_t i)
+{
+    struct tent *e = &t->ent[i];
+    uint32_t    c, k;
+    char        name[24];
+    long        x;
+
+    if (d >= path->nseg)
+    {
+        return i;
+    }
+    if ((e->type != T_OBJ) && (e->type != T_ARR))
+    {
+        return -1;
+    }
+    if ((e->type == T_ARR) && !path->glob)
+    {
+        /* scalars only: element k is entry i+1+k	*/
+        if (((x = tape_index(path->seg[d])) < 0) || (x >= e->n))
         {
-            p->done = 1;
+            return -1;
         }
-
-        /* finish building variable name when value node follows	*/
-        if (b->type == B_VAL)
+        for (c = i + 1, k = x; k && (e->next - i - 1 != e->n); k--)
         {
-            base_esc_end(p);
+            c = t->ent[c].next;
         }
-
-        /* copy codepage and esc mode from parent	*/
-        b->esc = p->esc;
-        b->cp  = p->cp;
+        return tape_lookup(t, path, d + 1, c + k);
     }
-    FATAL(b->next);
-    return b;
+    for (c = i + 1, k = 0; k < e->n; k++)
+    {
+        if (e->type == T_OBJ)
+        {
+            if (tape_match(t, &t->ent[c], path->seg[d], path->glob)
+                && ((x = tape_lookup(t, path, d + 1, c + 1)) >= 0))
+            {
+                return x;
+            }
+            c = t->ent[c + 1].next;
+            continue;
+        }
+        snprintf(name, sizeof name, "%u", k);
+        if ((path->glob ? !fnmatch(path->seg[d], name, 0) : !strcmp(path->seg[d], name))
+            && ((x = tape_lookup(t, path, d + 1, c)) >= 0))
+        {
+            return x;
+        }
+        c = t->ent[c].next;
+    }
+    return -1;
 }
 
 
-static BASE
-base_new(BASE p, enum base_type type)
+static void
+tape_stats(struct tape *t)
 {
-    BASE b;
+    if (J->stats)
+    {
+        fprintf(stderr, "%s: entries %lu, bytes %lu, cache hits %lu misses %lu\n", JSON2SH_NAME,
+                (unsigned long)t->n, (unsigned long)(t->n * sizeof *t->ent + t->len), cache_hits, cache_misses);
+    }
+}
 
-    FATAL(p && p->type == B_UNSPEC);
 
-    if (!base_freelist)
+/* json2sh query HANDLE: parse the input once into the tape of HANDLE.
+ * If HANDLE already has the file unchanged, that is kept.
+ */
+static int
+tape_query(int argc, char **argv)
+{
+    struct tape **tp, *t;
+
+    tp = tape_find(argv[1]);
+    if (J->in.regular && cache_max())
     {
-        base_freelist = alloc0(sizeof *base_freelist);
+        if (*tp && (*tp)->regular && ident_eq(&(*tp)->id, &J->in.id))
+        {
+            cache_hits++;
+            tape_stats(*tp);
+            return 0;
+        }
+        cache_misses++;
     }
 
-    b             = base_freelist;
-    base_freelist = b->next;
+    t       = J->tape = alloc0(sizeof *t);
+    t->name = alloc0(strlen(argv[1]) + 1);
+    strcpy(t->name, argv[1]);
+    t->regular = J->in.regular;
+    t->id      = J->in.id;
+    in_slurp(&t->text, &t->len);
+    tape_parse(t);
+    free(t->open);
+    t->open    = NULL;
+    t->openmax = 0;
+    J->tape    = NULL;
+    tape_stats(t);
+
+    t->next = *tp ? (*tp)->next : NULL;
+    tape_free(*tp);
+    *tp = t;
+    return 0;
+}
 
-    FATAL(b->type != B_UNSPEC);
 
-    /* CAVEAT!  When adding new properties to BASE
-     * be sure to initialize them here!
-     */
-    b->next  = 0;
-    b->top   = b;
-    b->type  = type;
-    b->done  = 0;
-    b->esc   = 0;
-    b->cp    = 0;
-    b->value = 0;
-    b->pos   = 0;
-    /* buflen and buf kept	*/
+/* json2sh get HANDLE PATH: output the value at PATH, a string
+ * decoded, anything else as its JSON text
+ */
+static int
+tape_get(int argc, char **argv)
+{
+    struct tape *t;
+    struct tent *e;
+    long        i;
 
-    return base_child(p, b);
+    if (!(t = *tape_find(argv[1])))
+    {
+        snprintf(J->err, sizeof J->err, "%s: no such handle", argv[1]);
+        builtin_error("%s", J->err);
+        return EXECUTION_FAILURE;
+    }
+    if (path_add(argv[2]) < 0)
+    {
+        snprintf(J->err, sizeof J->err, "%s: too many -p selectors", argv[2]);
+        builtin_error("%s", J->err);
+        return EXECUTION_FAILURE;
+    }
+    in_mem(t->text, t->len);
+    if ((i = tape_lookup(t, &J->paths[J->npaths - 1], 0, 0)) < 0)
+    {
+        snprintf(J->err, sizeof J->err, "%s: not found", argv[2]);
+        return EXECUTION_FAILURE;
+    }
+    e = &t->ent[i];
+    if (e->type == T_STR)
+    {
+        tape_string(e);
+        outn(J->key.buf, J->key.len - 1);
+    }
+    else
+    {
+        outn((const char *)t->text + e->off, e->len);
+    }
+    if (J->out.type == SINK_FD)
+    {
+        outc('\n');
+    }
+    return 0;
 }
 
 
-/* Cut the remaining base->next pointers.
- * This is because we are lazy.
- * We create base(parent), but we do not free it.
- *
- * Due to recursion, we know the sub-thing is no more needed,
- * so we can give it back to the pool.
+/* json2sh query|get|drop ARGS..
  */
-static void
-base_cut(BASE p)
+static int
+tape_main(const char *cmd, int argc, char **argv)
 {
-    BASE b;
+    struct tape **tp, *t;
 
-    if (p)
+    switch (*cmd)
     {
-        for (b = p->next; b; b = base_free(b))
+    case 'q':
+        if (argc == 2)
         {
-            if (b->done)
+            return tape_query(argc, argv);
+        }
+        break;
+
+    case 'g':
+        if (argc == 3)
+        {
+            return tape_get(argc, argv);
+        }
+        break;
+
+    case 'd':
+        if (argc == 2)
+        {
+            if (!(t = *(tp = tape_find(argv[1]))))
             {
-                p->done = 1;
+                snprintf(J->err, sizeof J->err, "%s: no such handle", argv[1]);
+                builtin_error("%s", J->err);
+                return EXECUTION_FAILURE;
             }
+            *tp = t->next;
+            tape_free(t);
+            return 0;
         }
-        p->next = 0;
+        break;
     }
+    builtin_usage();
+    return EX_USAGE;
 }
 
 
-static int
-base_done(BASE b)
+/**********************************************************************
+ * Context
+ *********************************************************************/
+
+/* The builtin's context, kept warm between calls
+ */
+static struct json2sh json2sh_ctx;
+
+/* Make ctx the context of this thread.
+ * Returns the previous one, to be given to json2sh_leave().
+ */
+static struct json2sh *
+json2sh_enter(struct json2sh *ctx)
 {
-    base_cut(b);
-    return b->done;
+    struct json2sh *old = J;
+
+    ctx->busy = 1;
+    J         = ctx;
+    return old;
+}
+
+
+static void
+json2sh_leave(struct json2sh *old)
+{
+    J->busy = 0;
+    J       = old;
 }
 
 
-/* Print out (repeat) the SHell variable name up to here
+/* After OOPS(): give the nodes of the unfinished chain
+ * back to the pool and close the input.
  */
 static void
-base_print(BASE b)
+json2sh_cleanup(void)
 {
-    D("(%p %d)", b, b->type);
-    nl();
-    for ( ; b; b = b->next)
-    {
-        outn(b->buf, b->pos);
-        b->done = 0;
-    }
+    J->root     = NULL;
+    J->freelist = NULL;
+    arena_reset(&J->arena);
+    J->out.len = 0;
+    in_close();
+    tape_free(J->tape);
+    J->tape = NULL;
+    lazy_close();
 }
 
 
-/* Setup for a new value to print out
+/* Give back everything ctx holds
  */
-static BASE
-base(BASE p, enum base_type type)
+static void
+json2sh_free(struct json2sh *ctx)
 {
-    D("(%p t=%d)", p, type);
-    base_cut(p);
+    struct chunk *c;
+    int          i;
 
-    D(" x1");
-    if (p && p->done)
+    while ((c = ctx->arena.first))
+    {
+        ctx->arena.first = c->next;
+        free(c);
+    }
+    free(ctx->in.block);
+    free(ctx->in.ix);
+    for (i = 0; i < ctx->stackmax; i++)
+    {
+        free(ctx->stack[i].vals.buf);
+    }
+    free(ctx->stack);
+    free(ctx->path.buf);
+    free(ctx->lvl);
+    free(ctx->out.buf);
+    free(ctx->pref.buf);
+    free(ctx->sep.buf);
+    free(ctx->lf.buf);
+    free(ctx->rs.buf);
+    free(ctx->bound.buf);
+    free(ctx->key.buf);
+    free(ctx->keyv);
+    free(ctx->num.buf);
+    for (i = 0; ctx->keys && i < JSON2SH_KEYS; i++)
     {
-        base_print(p->top);
+        free(ctx->keys[i].raw.buf);
+        free(ctx->keys[i].name.buf);
     }
+    free(ctx->keys);
+    tape_free(ctx->tape);
+    free(ctx->ckey.buf);
+    free(ctx->cout.buf);
+    free(ctx->whole.buf);
+    memset(ctx, 0, sizeof *ctx);
+}
 
-    D(" x2");
-    return base_new(p, type);
+
+/**********************************************************************
+ * Lazy variables (-l)
+ *********************************************************************/
+
+static struct lazy **lazies;            /* hash of the variables not read yet	*/
+static size_t      nlazy, lazymax;
+
+static unsigned
+lazy_hash(const char *s)
+{
+    unsigned h = 2166136261u;
+
+    while (*s)
+    {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+    return h;
 }
 
 
-static void
-base_fin(BASE b)
+/* Where the variable name is, or would go, in the hash.
+ * NULL while there is no hash.
+ */
+static struct lazy **
+lazy_slot(const char *name, unsigned h)
 {
-    base_esc_end(b);
-    if (!b->done)
+    struct lazy **lp;
+
+    if (!lazies)
     {
-        outb(SEP);
+        return NULL;
     }
-    b->done = 1;
+    for (lp = &lazies[h & (lazymax - 1)]; *lp; lp = &(*lp)->next)
+    {
+        if (((*lp)->hash == h) && !strcmp((*lp)->name, name))
+        {
+            break;
+        }
+    }
+    return lp;
 }
 
 
 static void
-base_out(BASE b, const char *s, ...)
+lazy_drop(struct lazy **lp)
 {
-    va_list list;
+    struct lazy *l = *lp;
 
-    va_start(list, s);
-    vout(s, list);
-    va_end(list);
+    *lp = l->next;
+    nlazy--;
+    free(l);
 }
 
 
-/* Send character, perhaps switching in esc mode:
- * 0: plain characters (0-9 A-Z a-z)
- * 1: indexes (1-999999999999999999999)
- * 2: object separator _0_
- * 3: all other escapes
+/* The variable was read or assigned, it is an ordinary one now
  */
 static void
-base_esc(BASE b, int c, int esc)
+lazy_forget(SHELL_VAR *v)
 {
-    if ((b->esc != esc) && ((b->esc & esc) == 0))
+    struct lazy **lp = lazy_slot(v->name, lazy_hash(v->name));
+
+    v->dynamic_value = NULL;
+    v->assign_func   = NULL;
+    if (lp && *lp)
     {
-        base_esc_end(b);
-        if (esc)
-        {
-            base_put(b, '_');
-        }
+        lazy_drop(lp);
     }
-    b->esc = esc;
-    base_put(b, c);
 }
 
 
-/* literal output (variable name)
+/* Decode the rest of J->in into J->key, like -b would bind it:
+ * strings decoded, constants as $JSON_true_ etc., and objects and
+ * arrays as their JSON text.
  */
 static void
-base_set(BASE b, struct _buf *buf)
+lazy_value(void)
 {
-    int i;
+    static const char *const consts[] = { "true", "false", "null" };
+    unsigned char            tmp[4];
+    char                     name[40];
+    const char               *val;
+    int                      c, i;
+
+    J->key.len = 0;
+    switch ((c = peek()))
+    {
+    case '"':
+        need("\"");
+        while ((c = uniget('"')) != EOF)
+        {
+            buf_add(&J->key, (const char *)tmp, utf8_put(tmp, c));
+        }
+        break;
 
-    for (i = 0; i < buf->len; i++)
+    case '{':
+    case '[':
+        buf_add(&J->key, (const char *)J->in.buf + J->in.pos, J->in.len - J->in.pos);
+        J->in.pos = J->in.len;
+        break;
+
+    case 't':
+    case 'f':
+    case 'n':
+        i = c == 't' ? 0 : c == 'f' ? 1 : 2;
+        need(consts[i]);
+        snprintf(name, sizeof name, "JSON_%s_", consts[i]);
+        val = get_string_value(name);
+        buf_add(&J->key, val ? val : "", val ? strlen(val) : 0);
+        break;
+
+    default:
+        num_scan();
+        buf_add(&J->key, J->num.buf, J->num.len);
+        break;
+    }
+    if (peek() != EOF)
     {
-        base_esc(b, buf->buf[i], 0);
+        OOPS("end of value expected");
     }
+    buf_add(&J->key, "", 1);
 }
 
 
-static BASE
-base_index(BASE p, int index)
+/* dynamic_value of a lazy variable: decode the value on the first
+ * read and keep it.  A value which turns out to be invalid is
+ * reported and left empty.
+ */
+static SHELL_VAR *
+lazy_get(SHELL_VAR *v)
 {
-    BASE b = base(p, B_INDEX);
-    char buf[200], *ptr;
+    struct lazy    **lp  = lazy_slot(v->name, lazy_hash(v->name));
+    struct lazy    *l    = lp ? *lp : NULL;
+    char           *text = value_cell(v);
+    struct json2sh *ctx, *old;
+    char           *val = NULL;
+
+    ctx = &json2sh_ctx;
+    if (text && (!ctx->busy || (ctx = calloc(1, sizeof *ctx))))
+    {
+        old = json2sh_enter(ctx);
+        if (setjmp(J->oops))
+        {
+            builtin_error("%s: %s", v->name, J->err);
+        }
+        else
+        {
+            in_mem((unsigned char *)text, strlen(text));
+            J->in.lines = l ? l->line : 0;  /* for in_where()	*/
+            J->in.col   = l ? l->col : 0;
+            lazy_value();
+            val = savestring(J->key.buf);
+        }
+        in_close();
+        json2sh_leave(old);
+        if (ctx != &json2sh_ctx)
+        {
+            json2sh_free(ctx);
+            free(ctx);
+        }
+    }
+    lazy_forget(v);
+    FREE(value_cell(v));
+    var_setvalue(v, val ? val : savestring(""));
+    return v;
+}
+
+
+/* assign_func of a lazy variable: the value is replaced unread
+ */
+static SHELL_VAR *
+lazy_set(
+    SHELL_VAR  *v,
+    char       *value,
+    arrayind_t unused,
+    char       *key)
+{
+    lazy_forget(v);
+    FREE(value_cell(v));
+    var_setvalue(v, savestring(value ? value : ""));
+    return v;
+}
+
+
+/* Bind the name in J->out as a dynamic variable for the
+ * len bytes at off of the input.  The variable holds a copy of
+ * them, so they go away when it is unset.
+ */
+static void
+lazy_bind(size_t off, size_t len)
+{
+    struct lazydoc      *d = J->lazy;
+    struct lazy         **tab, **lp, *l;
+    const unsigned char *p, *e, *nl;
+    SHELL_VAR           *v;
+    char                *text;
+    unsigned            h;
+    size_t              i;
+
+    if (!(v = base_bind("")) || readonly_p(v))
+    {
+        return;
+    }
+    if (array_p(v) || assoc_p(v))
+    {
+        OOPS("'%s' is an array", v->name);
+    }
+    text = re_alloc(NULL, len + 1);
+    memcpy(text, J->in.buf + off, len);
+    text[len] = 0;
+    FREE(value_cell(v));
+    var_setvalue(v, text);
+
+    /* like in_count(), from the last value on	*/
+    for (p = J->in.buf + d->pos, e = J->in.buf + off; (nl = memchr(p, '\n', e - p)); p = nl + 1)
+    {
+        d->line++;
+        d->col = 0;
+    }
+    d->col += e - p;
+    d->pos  = off;
+
+    if (nlazy >= lazymax / 2)
+    {
+        i       = lazymax;
+        tab     = lazies;
+        lazymax = lazymax ? 2 * lazymax : 1024;
+        lazies  = alloc0(lazymax * sizeof *lazies);
+        while (i--)
+        {
+            while ((l = tab[i]))
+            {
+                tab[i]  = l->next;
+                lp      = &lazies[l->hash & (lazymax - 1)];
+                l->next = *lp;
+                *lp     = l;
+            }
+        }
+        free(tab);
+    }
 
-    base_esc_end(b);
-    snprintf(buf, sizeof buf, "%d", index);
-    for (ptr = buf; *ptr; )
+    h  = lazy_hash(v->name);
+    lp = lazy_slot(v->name, h);
+    if (*lp)
     {
-        base_esc(b, *ptr++, 1);
+        lazy_drop(lp);  /* unset while unread	*/
     }
-    return b;
+    l       = re_alloc(NULL, sizeof *l + strlen(v->name) + 1);
+    l->next = *lp;
+    l->hash = h;
+    l->line = d->line;
+    l->col  = d->col;
+    strcpy(l->name, v->name);
+    *lp = l;
+    nlazy++;
+
+    v->dynamic_value = lazy_get;
+    v->assign_func   = lazy_set;
 }
 
 
+/* The values are skipped over and copied, so all of the input
+ * must be in memory.  Nothing points into it afterwards, a mapped
+ * file may change or shrink while the variables are not read yet.
+ */
 static void
-base_hex(BASE b, int hex)
+lazy_open(void)
 {
-    base_esc(b, "zyxwusqpomlkjihg"[hex & 0xf], 3);
+    J->lazy = alloc0(sizeof *J->lazy);
+    if (!J->in.maplen)
+    {
+        in_slurp(&J->lazy->text, &J->lazy->len);
+    }
 }
 
 
 static void
-base_cp26(BASE b, unsigned cp)
+lazy_close(void)
 {
-    if (cp > 25)
+    if (J->lazy)
     {
-        base_cp26(b, cp / 26);
+        free(J->lazy->text);
+        free(J->lazy);
+        J->lazy = NULL;
     }
-    base_esc(b, "ABCDEFGHIJKLMNOPQRSTUVWXYZ"[cp % 26], 3);
 }
 
 
+/* Before the code goes away: read what is still lazy.  Looking
+ * a variable up reads it, the global one too when a local hides
+ * it, so no dynamic_value is left pointing here.
+ */
 static void
-base_cp(BASE b, unsigned cp)
+lazy_unload(void)
 {
-    if (b->cp == cp)
+    struct lazy **lp;
+    char        *name;
+    size_t      i;
+
+    for (i = 0; i < lazymax; i++)
     {
-        return;
+        while (lazies[i])
+        {
+            name = savestring(lazies[i]->name);
+            find_variable(name);
+            find_global_variable(name);
+            if ((lp = lazy_slot(name, lazy_hash(name))) && *lp)
+            {
+                lazy_drop(lp);  /* unset	*/
+            }
+            free(name);
+        }
     }
+    free(lazies);
+    lazies  = NULL;
+    lazymax = 0;
+}
 
-    b->cp = cp;
-    base_cp26(b, cp);
+
+/**********************************************************************
+ * Batches (-j)
+ *********************************************************************/
+
+/* Make ctx the context of this thread, with the options of
+ * the shell's run.  Returns the previous one.
+ */
+static struct json2sh *
+batch_enter(struct batch *B, struct json2sh *ctx)
+{
+    struct json2sh *old = json2sh_enter(ctx);
+
+    J->stream   = B->shell->stream;
+    J->maxdepth = B->shell->maxdepth;
+    J->arrays   = B->shell->arrays;
+    J->assoc    = B->shell->assoc;
+    J->integers = B->shell->integers;
+    J->ref      = 0;
+    J->nr       = 0;
+    J->err[0]   = 0;
+    return old;
 }
 
 
-static int
-simple_value(int ch)
+/* The output and the counters of the run go to j
+ */
+static void
+batch_leave(struct job *j, struct json2sh *old)
 {
-    return (ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z');
+    memcpy(j->err, J->err, sizeof j->err);
+    j->out.buf   = J->out.buf;          /* take it over	*/
+    j->out.len   = J->out.len;
+    J->out.buf   = NULL;
+    J->out.len   = J->out.max = 0;
+    j->nodes     = J->arena.nodes;
+    j->allocs    = J->arena.allocs;
+    j->mallocs   = J->arena.mallocs;
+    j->bytes     = J->arena.bytes;
+    j->keyhits   = J->keyhits;
+    j->keymisses = J->keymisses;
+    json2sh_leave(old);
 }
 
 
+/* Parse the FILE of j with ctx.  Nothing of bash is called here,
+ * the output stays in j->out for the shell's thread to write.
+ */
 static void
-base_escape(BASE b, int ch)
+batch_one(struct batch *B, struct json2sh *ctx, struct job *j)
 {
-    switch (ch)
-    {
-    case EOF:
-        return;
+    struct json2sh *old    = batch_enter(B, ctx);
+    char           *argv[] = { JSON2SH_NAME, NULL };
+    int            i;
 
-    case '_':
-        /* perhaps delay a bit, to see if we enter or leave ->esc	*/
-        if (b->esc)
+    J->nr = j->nr;
+    if (setjmp(J->oops))
+    {
+        json2sh_cleanup();
+        j->ret = JSON2SH_OOPS;
+    }
+    else
+    {
+        buf(&J->rs, B->rs);
+        for (i = 0; i < B->npaths; i++)
         {
-            base_esc(b, 'c', 3);
+            path_add(B->paths[i]);
+        }
+        if (in_open(j->file))
+        {
+            snprintf(J->err, sizeof J->err, "%s", in_strerror(errno));
+            j->ret = EXECUTION_FAILURE;
         }
         else
         {
-            base_esc(b, ch, 0);
-            base_esc(b, ch, 0);
+            sink_init(&J->out, SINK_MEM, -1, NULL);
+            if (J->npaths)
+            {
+                ix_start();
+            }
+            j->ret = json2sh_main(1, argv);
+            in_close();
         }
-        return;
-
-    case '\a':
-        base_esc(b, 'a', 3);
-        return;
-
-    case '\b':
-        base_esc(b, 'b', 3);
-        return;
+    }
+    path_free();
+    batch_leave(j, old);
+}
 
-    case '\177':
-        base_esc(b, 'd', 3);
-        return;
 
-    case '\033':
-        base_esc(b, 'e', 3);
-        return;
+/* Parse the elements of the top-level array from j->off up to
+ * the ',' which j->end follows, as j_member() and j_close()
+ * would do for them
+ */
+static void
+split_one(struct batch *B, struct json2sh *ctx, struct job *j)
+{
+    struct json2sh *old    = batch_enter(B, ctx);
+    char           *argv[] = { JSON2SH_NAME, NULL };
+    char           name[24];
+    BASE           root, a, t;
+    int            i;
 
-    case '\f':
-        base_esc(b, 'f', 3);
-        return;
+    if (setjmp(J->oops))
+    {
+        j->out.len = J->out.len;        /* what was output before the error is kept	*/
+        json2sh_cleanup();
+        J->out.len = j->out.len;
+        j->ret     = JSON2SH_OOPS;
+    }
+    else
+    {
+        for (i = 0; i < B->npaths; i++)
+        {
+            path_add(B->paths[i]);
+        }
+        json2sh_setup(1, argv);
+        in_mem(B->text, B->len);
+        J->in.pos = j->off;
+        sink_init(&J->out, SINK_MEM, -1, NULL);
+        if (J->npaths)
+        {
+            ix_start();
+        }
 
-    case '\n':
-        base_esc(b, 'n', 3);
-        return;
+        J->lines = 0;
+        J->root  = root = base_new(NULL, B_PREFIX);
+        path_root(root);
+        base_set(root, &J->pref);
+        a        = base(root, B_ARR);
+        J->depth = 0;
+        j_push(a, 0);
+        for (j->n = 1; ; j->n++)        /* as j_member() does	*/
+        {
+            t = base_index(a, j->first + j->n - 1);
+            if (!a->sel)
+            {
+                snprintf(name, sizeof name, "%d", j->first + j->n - 2);
+            }
+            if (a->sel || base_select(a, t, name))
+            {
+                j_value(t);
+            }
+            else
+            {
+                skip_value();
+            }
+            if (have(']'))
+            {
+                j->closed = 1;
+                break;
+            }
+            need(",");
+            if (J->in.pos >= j->end)
+            {
+                break;
+            }
+        }
+        j->stop    = J->in.pos;
+        j->printed = base_done(a);      /* the LF is up to batch_run()	*/
+        J->root     = NULL;
+        J->freelist = NULL;
+        arena_reset(&J->arena);
+        in_close();
+        j->ret = 0;
+    }
+    path_free();
+    batch_leave(j, old);
+}
 
-    case '\r':
-        base_esc(b, 'r', 3);
-        return;
 
-    case '\t':
-        base_esc(b, 't', 3);
-        return;
+/* The scan guessed where chunk j starts, which holds when the
+ * chunk before it stopped there.  It does for valid JSON, else
+ * the rest is parsed as one chunk from where that one stopped,
+ * on the shell's thread.  Returns 1 then.
+ */
+static int
+split_check(struct batch *B, struct job *j)
+{
+    struct job     *p = j - 1;
+    struct json2sh *ctx;
 
-    case '\v':
-        base_esc(b, 'v', 3);
-        return;
+    if ((p->stop == j->off) && (p->first + p->n == j->first))
+    {
+        return 0;
     }
-
-    if (simple_value(ch))
+    free(j->out.buf);
+    memset(j, 0, sizeof *j);
+    j->off   = p->stop;
+    j->end   = (size_t)-1;
+    j->first = p->first + p->n;
+    if (!(ctx = calloc(1, sizeof *ctx)))
     {
-        base_esc(b, ch, 0);
-        return;
+        snprintf(j->err, sizeof j->err, "out of memory");
+        j->ret = EXECUTION_FAILURE;
+        return 1;
     }
-
-    base_cp(b, ch >> 8);
-    base_hex(b, ch >> 4);
-    base_hex(b, ch);
+    split_one(B, ctx, j);
+    json2sh_free(ctx);
+    free(ctx);
+    return 1;
 }
 
-
-static void
-base_add(BASE b, int ch)
+/* A worker: take the next job until there are none left
+ */
+static void *
+batch_worker(void *arg)
 {
-    if (ch == EOF)
+    struct batch   *B   = arg;
+    struct json2sh *ctx = calloc(1, sizeof *ctx);
+    struct job     *j;
+
+    for (;;)
     {
-        switch (b->value)
+        pthread_mutex_lock(&B->lock);
+        j = B->next < B->n ? &B->jobs[B->next++] : NULL;
+        pthread_mutex_unlock(&B->lock);
+        if (!j)
         {
-        case 0:
-            outn(b->buf, b->pos);
-            return;
-
-        case 1:
-            outc('\'');
-            outn(b->buf, b->pos);
-
-        default:
-            outc('\'');
-            return;
+            break;
         }
-    }
-    if ((b->value < 2) && (b->pos < 255))
-    {
-        if (((b->value == 0) && simple_value(ch)) || (b->value = 1, (ch >= 32) && (ch <= 255) && (ch != '\'') && (ch != 127)))
+        if (!ctx)
         {
-            base_put(b, ch);
-            return;
+            snprintf(j->err, sizeof j->err, "out of memory");
+            j->ret = EXECUTION_FAILURE;
         }
-    }
-    if (b->value < 3)
-    {
-        int i;
-
-        outn("$'", 2);
-        for (i = 0; i < b->pos; i++)
+        else if (B->text)
         {
-            oute((unsigned char)b->buf[i]);
+            split_one(B, ctx, j);
+        }
+        else
+        {
+            batch_one(B, ctx, j);
         }
+        pthread_mutex_lock(&B->lock);
+        j->done = 1;
+        pthread_cond_broadcast(&B->done);
+        pthread_mutex_unlock(&B->lock);
     }
-    b->value = 3;
-    oute(ch);
+    if (ctx)
+    {
+        json2sh_free(ctx);
+        free(ctx);
+    }
+    return NULL;
 }
 
 
+/* Run the jobs of B on N threads, and write their output in
+ * order as each is done.  A FILE which fails is reported and
+ * left out, a chunk which fails ends the output.  Returns the
+ * status of the first failing, its error is left in J->err.
+ */
 static int
-base_if(BASE b, const char *chars)
+batch_run(struct batch *B, int nthreads)
 {
-    int c;
+    struct job   *j;
+    pthread_t    *tid = alloc0(nthreads * sizeof *tid);
+    sigset_t     all, mask;
+    jmp_buf      outer;
+    volatile int ret = 0, i, last = 0;
+    int          nt = 0;
+    char         msg[sizeof J->err];
+
+    B->shell = J;
+    B->next  = 0;
+    pthread_mutex_init(&B->lock, NULL);
+    pthread_cond_init(&B->done, NULL);
+
+    /* signals are for the shell's thread	*/
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &mask);
+    for (i = 0; (i < nthreads) && (i < B->n); i++)
+    {
+        if (!pthread_create(&tid[nt], NULL, batch_worker, B))
+        {
+            nt++;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+    if (!nt)
+    {
+        batch_worker(B);
+    }
 
-    c = ch();
-    if (!strchr(chars, c))
+    J->arena.nodes = J->arena.allocs = J->arena.mallocs = J->arena.bytes = 0;
+    J->keyhits     = J->keymisses = 0;
+    memcpy(outer, J->oops, sizeof outer);
+    if (setjmp(J->oops))
     {
-        ungetc(c, stdin);
-        return 0;
+        builtin_error("%s", J->err);    /* write error, stop	*/
+        ret = JSON2SH_OOPS;
     }
-    base_fin(b);
-    base_add(b, c);
-    return 1;
+    else
+    {
+        for (i = 0; (i < B->n) && !(ret && B->text) && !B->closed && !last; i++)
+        {
+            j = &B->jobs[i];
+            pthread_mutex_lock(&B->lock);
+            while (!j->done)
+            {
+                pthread_cond_wait(&B->done, &B->lock);
+            }
+            pthread_mutex_unlock(&B->lock);
+            last = B->text && i && split_check(B, j);
+
+            if (j->ret)
+            {
+                if (j->file)
+                {
+                    snprintf(msg, sizeof msg, "%.*s: %.*s", 127, j->file, 126, j->err);
+                }
+                else
+                {
+                    memcpy(msg, j->err, sizeof msg);
+                }
+                builtin_error("%s", msg);
+                if (!ret)               /* JSON2SH_ERROR is of the first	*/
+                {
+                    memcpy(J->err, msg, sizeof J->err);
+                }
+            }
+            if (j->out.len && (!j->ret || B->text))
+            {
+                if (B->text && B->lines)
+                {
+                    outb(&J->lf);       /* chunks end without LF	*/
+                }
+                outn(j->out.buf, j->out.len);
+                B->lines = 1;
+            }
+            ret = ret ? ret : j->ret;
+            if (B->text)
+            {
+                B->printed |= j->printed;
+                B->closed   = j->closed;
+                B->stop     = j->stop;
+            }
+            free(j->out.buf);
+            j->out.buf        = NULL;
+            J->arena.nodes   += j->nodes;
+            J->arena.allocs  += j->allocs;
+            J->arena.mallocs += j->mallocs;
+            J->arena.bytes   += j->bytes;
+            J->keyhits       += j->keyhits;
+            J->keymisses     += j->keymisses;
+        }
+    }
+    memcpy(J->oops, outer, sizeof outer);
+
+    pthread_mutex_lock(&B->lock);
+    B->next = B->n;                     /* start no more	*/
+    pthread_mutex_unlock(&B->lock);
+    for (i = 0; i < nt; i++)
+    {
+        pthread_join(tid[i], NULL);
+    }
+    for (i = 0; i < B->n; i++)
+    {
+        free(B->jobs[i].out.buf);
+    }
+    pthread_cond_destroy(&B->done);
+    pthread_mutex_destroy(&B->lock);
+    free(tid);
+    return ret;
 }
 
 
+/* -j N FILE..: parse the FILEs on N threads
+ */
 static int
-base_digit(BASE b)
+batch_main(int nthreads, int argc, char **argv, const char *rs, char **paths, int npaths)
 {
-    return base_if(b, "0123456789");
+    struct batch B;
+    int          i, ret;
+
+    memset(&B, 0, sizeof B);
+    B.n      = argc - 1;
+    B.jobs   = alloc0(B.n * sizeof *B.jobs);
+    B.rs     = rs;
+    B.paths  = paths;
+    B.npaths = npaths;
+    for (i = 0; i < B.n; i++)
+    {
+        B.jobs[i].file = argv[i + 1];
+        B.jobs[i].nr   = i + 1;
+    }
+    ret = batch_run(&B, nthreads);
+    free(B.jobs);
+    return ret;
 }
 
 
-static void
-base_digits(BASE b)
+/* A step of the scan: c is the next character
+ */
+static inline void
+split_step(int c, int *esc, int *quotes)
 {
-    if (!base_digit(b))
+    if (*esc)
     {
-        OOPS("number expected");
+        *esc = 0;
+    }
+    else if (c == '\\')
+    {
+        *esc = 1;
     }
-    while (base_digit(b))
+    else if (c == '"')
     {
+        *quotes ^= 1;
     }
 }
 
 
-/**********************************************************************
- * JSON helpers
- *********************************************************************/
-
-/* if b!=NULL then assemble a string suitable for shell variable,
- * else assemble a string suitable for shell variable content.
+/* The block of the input which c is in, with what is not from
+ * c up to hi as blanks, as ix_chunk() does.  *n is where it ends.
  */
-static BASE
-get_string(BASE p)
+static const unsigned char *
+split_block(struct batch *B, size_t c, size_t hi, unsigned char *tmp, size_t *n)
 {
-    BASE b = base(p, B_VAL);
-    int  c;
+    const unsigned char *p  = B->text + (c & ~(size_t)63);
+    size_t              lo  = c & 63;
 
-    base_fin(b);
-    D("");
-    need("\"");
-    while ((c = uniget('"')) != EOF)
+    *n = hi - (c & ~(size_t)63) < 64 ? hi - (c & ~(size_t)63) : 64;
+    if ((lo > 0) || (*n < 64))
     {
-        base_add(b, c);
+        memset(tmp, ' ', 64);
+        memcpy(tmp + lo, p + lo, *n - lo);
+        p = tmp;
     }
-    base_add(b, EOF);
-    D(" ret");
-
-    return b;
+    return p;
 }
 
 
-static BASE
-get_key(BASE p)
+/* The first pass of the scan, for each range on its own: whether
+ * it has an odd number of '"' and ends escaped, if lo is not
+ */
+static void
+split_quotes(struct batch *B, struct range *r)
 {
-    BASE b = base(p, B_KEY);
-    int  c;
+    const unsigned char *p;
+    unsigned char       tmp[64];
+    uint64_t            quote, bs, brk, carry = 0;
+    size_t              c, n;
 
-    need("\"");
-    while ((c = uniget('"')) != EOF)
+    r->esc = 0;
+    for (c = r->lo; c < r->hi; c = (c | 63) + 1)
     {
-        base_escape(b, c);
+        p = split_block(B, c, r->hi, tmp, &n);
+        ix_kernel(p, &quote, &bs, &brk);
+        ix_strings(&quote, bs, n, &r->esc, &carry);
     }
-    base_escape(b, EOF);
-
-    return b;
+    r->quotes = carry & 1;
 }
 
 
-/**********************************************************************
- * JSON datatypes
- *********************************************************************/
-
-void j_value(BASE b);
-
+/* As split_quotes(), for a range where lo is escaped.  Both ways
+ * agree after the '\\'s at lo, only these are looked at again.
+ */
 static void
-j_string(BASE b)
+split_escaped(struct batch *B, struct range *r, int *quotes, int *esc)
 {
-    D("");
-    FATAL(b->next);
-    get_string(b);
-    D(" ret");
+    const unsigned char *p = B->text + r->lo, *e = B->text + r->hi;
+    int                 esc0 = 0, esc1 = 1, quotes0 = 0, quotes1 = 0;
+
+    for ( ; (p < e) && (esc0 != esc1); p++)
+    {
+        split_step(*p, &esc0, &quotes0);
+        split_step(*p, &esc1, &quotes1);
+    }
+    *quotes = esc0 == esc1 ? r->quotes ^ quotes0 ^ quotes1 : quotes1;
+    *esc    = esc0 == esc1 ? r->esc : esc1;
 }
 
 
+/* The second pass, with what the first found for the ranges
+ * before: the depth outside of strings, and the ','s where it
+ * is least.  These are the top-level ones, if any are.
+ */
 static void
-j_const(BASE b, const char *var)
+split_depth(struct batch *B, struct range *r)
 {
-    D("var=%s", var);
-    need(var);
-    base_fin(b);
-    base_out(b, "$JSON_%s_", var);
+    const unsigned char *p, *q;
+    unsigned char       tmp[64];
+    uint64_t            quote, bs, brk, str;
+    uint64_t            carry = r->str ? ~(uint64_t)0 : 0;
+    int                 esc   = r->escaped;
+    long                d     = 0;
+    size_t              c, i, k, n;
+
+    r->min    = LONG_MAX;
+    r->commas = 0;
+    for (c = r->lo; c < r->hi; c = (c | 63) + 1)
+    {
+        p   = split_block(B, c, r->hi, tmp, &n);
+        ix_kernel(p, &quote, &bs, &brk);
+        str = ix_strings(&quote, bs, n, &esc, &carry);
+        brk &= ~str;
+
+        /* between brackets the depth stays, ','s are only looked
+         * for where it is not more than the least so far
+         */
+        for (i = c & 63; ; i = k + 1)
+        {
+            k = brk ? (size_t)__builtin_ctzll(brk) : n;
+            while ((d <= r->min) && (q = memchr(p + i, ',', k - i)))
+            {
+                i = q - p + 1;
+                if ((str >> (i - 1)) & 1)
+                {
+                    continue;
+                }
+                if (d < r->min)
+                {
+                    r->min    = d;
+                    r->commas = 0;
+                    r->comma  = (c & ~(size_t)63) + i - 1;
+                }
+                r->commas++;
+            }
+            if (!brk)
+            {
+                break;
+            }
+            d   += (p[k] == '{') || (p[k] == '[') ? 1 : -1;
+            brk &= brk - 1;
+        }
+    }
+    r->delta = d;
 }
 
 
-static void
-j_object(BASE p)
+/* A worker of the scan: the pass on the next range until there
+ * are none left
+ */
+static void *
+split_worker(void *arg)
 {
-    BASE b = base(p, B_OBJ);
-
-    D("(%d)", b->done);
-    if (p->type != B_INDEX)
-    {
-        base_esc(b, '0', 2);
-    }
-    D("(%d)", b->done);
+    struct batch *B = arg;
+    struct range *r;
 
-    need("{");
-    while (!have('}'))
+    for (;;)
     {
-        BASE t;
-
-        if (base_done(b))
+        pthread_mutex_lock(&B->lock);
+        r = B->next < B->nranges ? &B->ranges[B->next++] : NULL;
+        pthread_mutex_unlock(&B->lock);
+        if (!r)
         {
-            need(",");
+            break;
         }
-        D(" here2");
-        t = get_key(b);
-        need(":");
-        FATAL(t->next);
-        D(" here3 %d", t->done);
-        j_value(t);
-        D(" here1");
-    }
-    if (!base_done(b))
-    {
-        base_fin(b);
-        base_out(b, "$JSON_nothing_");
+        B->pass(B, r);
     }
+    return NULL;
 }
 
 
+/* Run the pass on all ranges, on N threads with the shell's
+ */
 static void
-j_array(BASE p)
+split_pass(struct batch *B, int nthreads, void (*pass)(struct batch *, struct range *))
 {
-    BASE b     = base(p, B_ARR);
-    int  index = 0;
-
-    D("()");
-    need("[");
-    while (!have(']'))
+    pthread_t *tid = alloc0(nthreads * sizeof *tid);
+    sigset_t  all, mask;
+    int       i, nt = 0;
+
+    B->pass = pass;
+    B->next = 0;
+    pthread_mutex_init(&B->lock, NULL);
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &mask);
+    for (i = 1; (i < nthreads) && (i < B->nranges); i++)
     {
-        BASE t;
-
-        if (base_done(b))
+        if (!pthread_create(&tid[nt], NULL, split_worker, B))
         {
-            need(",");
+            nt++;
         }
-        t = base_index(b, ++index);
-        j_value(t);
     }
-    if (!base_done(b))
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+    split_worker(B);
+    for (i = 0; i < nt; i++)
     {
-        base_fin(b);
-        base_out(b, "$JSON_empty_");
+        pthread_join(tid[i], NULL);
     }
-    D(" ret");
+    pthread_mutex_destroy(&B->lock);
+    free(tid);
 }
 
 
+/* The scan: cut the input from start into ranges of size bytes,
+ * a multiple of the blocks of the index, and each range into a chunk from its first top-level ','.  As
+ * the '"'s before a range tell whether it starts in a string,
+ * and the brackets before it its depth, this takes two passes,
+ * each in parallel, and a quick walk over the ranges after each.
+ * The chunks are numbered by the ','s before them.
+ */
 static void
-j_number(BASE p)
+split_scan(struct batch *B, int nthreads, size_t start, size_t size)
 {
-    BASE b = base(p, B_VAL);
-
-    D("()");
-    base_if(b, "-");
-
-    if (!base_if(b, "0"))
+    struct range *r;
+    struct job   *j;
+    size_t       base = start & ~(size_t)63;
+    int          i, quotes, esc, str = 0;
+    long         depth = 1;
+    int          nr    = 1;             /* the element at the range	*/
+
+    B->nranges = (B->len - base + size - 1) / size;
+    B->ranges  = alloc0(B->nranges * sizeof *B->ranges);
+    for (i = 0; i < B->nranges; i++)
     {
-        base_digits(b); /* we know it is not 0	*/
+        B->ranges[i].lo = i ? base + i * size : start;
+        B->ranges[i].hi = i + 1 < B->nranges ? base + (i + 1) * size : B->len;
     }
-    if (base_if(b, "."))
+
+    split_pass(B, nthreads, split_quotes);
+    for (esc = i = 0; i < B->nranges; i++)
     {
-        base_digits(b);
+        r          = &B->ranges[i];
+        r->str     = str;
+        r->escaped = esc;
+        if (esc)
+        {
+            split_escaped(B, r, &quotes, &esc);
+        }
+        else
+        {
+            quotes = r->quotes;
+            esc    = r->esc;
+        }
+        str ^= quotes;
     }
 
-    if (base_if(b, "eE"))
+    split_pass(B, nthreads, split_depth);
+    B->max  = B->nranges + 1;
+    B->jobs = alloc0(B->max * sizeof *B->jobs);
+    j        = &B->jobs[B->n++];
+    j->off   = start;
+    j->first = 1;
+    for (i = 0; i < B->nranges; i++)
     {
-        base_if(b, "+-");
-        base_digits(b);
+        r = &B->ranges[i];
+        if (r->commas && (depth + r->min == 1))
+        {
+            j->end   = r->comma + 1;
+            j        = &B->jobs[B->n++];
+            j->off   = r->comma + 1;
+            j->first = nr + 1;
+            nr      += r->commas;
+        }
+        depth += r->delta;
     }
-    base_fin(b);
-    base_add(b, EOF);
-    D(" ret");
+    j->end = (size_t)-1;
 }
 
 
-void
-j_value(BASE b)
+/* The chunks went well and the ']' was read: close the array
+ * as j_close() would, it is empty if no chunk output any of it.
+ * The last line is ended unless there is more input.
+ */
+static void
+split_end(struct batch *B, int empty)
 {
-    D("()");
-    switch (peek())
+    BASE root, a;
+
+    J->lines = B->lines;
+    J->root  = root = base_new(NULL, B_PREFIX);
+    path_root(root);
+    base_set(root, &J->pref);
+    a        = base(root, B_ARR);
+    if (empty && a->sel)
     {
-    case EOF:
-        OOPS("unexpected EOF");
-
-    case '{':
-        j_object(b);
-        break;
-
-    case '[':
-        j_array(b);
-        break;
-
-    case '"':
-        j_string(b);
-        break;
-
-    case 't':
-        j_const(b, "true");
-        break;
-
-    case 'f':
-        j_const(b, "false");
-        break;
-
-    case 'n':
-        j_const(b, "null");
-        break;
-
-    default:
-        j_number(b);
-        break;
+        base_fin(a);
+        base_const(a, "empty");
     }
-    D(" ret");
+    if (J->lines && !B->err[0])
+    {
+        nl();
+    }
+    J->root     = NULL;
+    J->freelist = NULL;
+    arena_reset(&J->arena);
 }
 
 
-int
-json2sh_main(int argc, char **argv)
+/* The input is an array with at least one element, and the
+ * '[' was read.  What follows its ']' is only looked at when
+ * the chunks are fine, so the error is the same as without -j.
+ */
+static int
+split_array(int nthreads, const char *rs, char **paths, int npaths)
 {
-    printf("The following arguments were passed to main():\n");
-    printf("argnum \t value \n");
-    for (int i = 0; i < argc; i++)
+    struct batch *B      = alloc0(sizeof *B);
+    char         *argv[] = { JSON2SH_NAME, NULL };
+    jmp_buf      outer;
+    size_t       start   = J->in.pos;
+    size_t       size;
+    int          ret;
+
+    json2sh_setup(1, argv);             /* for split_end()	*/
+    B->text   = J->in.buf;
+    B->len    = J->in.len;
+    B->rs     = rs;
+    B->paths  = paths;
+    B->npaths = npaths;
+    size      = J->in.len / (8 * nthreads);
+    size      = size < JSON2SH_BLOCK ? JSON2SH_BLOCK : (size + 63) & ~(size_t)63;
+    split_scan(B, nthreads, start, size);
+
+    ret = batch_run(B, nthreads);
+    if (!ret && B->closed)
     {
-        printf("%d \t %s \n", i, argv[i]);
+        memcpy(outer, J->oops, sizeof outer);
+        if (setjmp(J->oops))
+        {
+            memcpy(B->err, J->err, sizeof B->err);
+        }
+        else
+        {
+            J->in.pos = B->stop;
+            if (peek() != EOF)
+            {
+                OOPS("end of input expected");
+            }
+        }
+        memcpy(J->oops, outer, sizeof outer);
+        split_end(B, !B->printed);
     }
-    printf("\n");
-
-
-    BASE b;
-
-    if ((argc > 4) || ((argc > 1) && (argv[1][0] == '-')))
+    if (!ret && B->err[0])
     {
-        fprintf(stderr, "Usage: %s [PREFIX [SEP [LF]]]\n"
-                        "\t\tVersion " JSON2SH_VERSION " from "
-                                                       "\tConvert any JSON into lines readable by shell.\n"
-                                                       "\tdefault: PREFIX='JSON_' SEP='=' LF='\\n'\n"
-                                                       "\tPREFIX/SEP/LF are de-escaped if they start with '\\'.\n"
-                                                       "\t\t\\i to ignore the initial '\\'.\n"
-                                                       "\t\t\\c to ignore the rest of the string.\n"
-                                                       "\t\t\\C to copy the rest of the string as-is.\n"
-                                                       "\tExamples:\n"
-                                                       "\t\tUse $ARG from env as-is: '\\C'\"$ARG\"\n"
-                                                       "\t\tWrite ARGs like '-\\r\\n' as '\\i''-\\r\\n'\n"
-                                                       "\t\tjson2sh <<< '[ true, false, null, [], {} ]'\n"
-                , JSON2SH_NAME);
-        return 42;
+        memcpy(J->err, B->err, sizeof J->err);
+        builtin_error("%s", J->err);
+        ret = JSON2SH_OOPS;
     }
+    free(B->ranges);
+    free(B->jobs);
+    free(B);
+    return ret;
+}
 
-    PREF = buf(argc > 1 ? argv[1] : "JSON_");
-    SEP  = buf(argc > 2 ? argv[2] : "=");
-    LF   = buf(argc > 3 ? argv[3] : "\n");
 
-    b = base_new(NULL, B_PREFIX);
-    base_set(b, PREF);
-    return 10;
-    j_value(b);
-    if (peek() != EOF)
+/* -j N without FILEs: the elements of a top-level array are
+ * parsed in chunks on N threads, anything else as usual
+ */
+static int
+split_main(int nthreads, int argc, char **argv, const char *rs, char **paths, int npaths)
+{
+    if (!J->in.maplen)
     {
-        OOPS("end of input expected");
+        in_slurp((unsigned char **)&J->whole.buf, &J->whole.len);
     }
-    if (base_done(b))
+    if ((nthreads > 1) && (peek() == '['))
     {
-        nl();
+        need("[");
+        if (!have(']'))
+        {
+            return split_array(nthreads, rs, paths, npaths);
+        }
     }
-
-    return 0;
+    J->in.pos = 0;
+    if (J->npaths)
+    {
+        ix_start();
+    }
+    return json2sh_main(argc, argv);
 }
 
 
@@ -1732,15 +5974,6 @@ enable_epochrealtime_builtin(WORD_LIST *list)
 
 
 
-    char *json2sh_main_args[NUMBER_OF_STRING][MAX_STRING_SIZE] =
-    {   "json2sh",
-        "{\"abc\": 123}\0"
-    };
-
-    int jm, list_qty, ii;
-
-    jm = json2sh_main(NUMBER_OF_STRING, json2sh_main_args);
-    fprintf(stdout, "\n>>>>>>>>>\t\tjson2sh_main exit code :\t\t%d\t\t\n", jm);
     fprintf(stdout, ">>>>>>>>>\t\ttv_sec :\t\t%d\t\t\n", tv.tv_sec);
     fprintf(stdout, ">>>>>>>>>\t\ttv_usec:\t\t%d\t\t\n", tv.tv_usec);
     fprintf(stdout, ">>>>>>>>>\t\tdecsize:\t\t%d\t\t\n", strlen(decoded));
@@ -1860,3 +6093,370 @@ struct builtin hello_struct =
     "hello",                    /* usage synopsis; becomes short_doc */
     0                           /* reserved for internal use */
 };
+
+
+/* json2sh as a loadable builtin:
+ *
+ *	enable -f hello.so json2sh
+ *	eval "$(json2sh < x.json)"
+ *	json2sh -b -f x.json
+ *	json2sh -v out < x.json; eval "$out"
+ *
+ * The second form skips the subshell and the eval by binding
+ * the shell variables directly, and maps the file instead of
+ * reading it through a pipe.  The third one only saves the fork.
+ */
+int
+json2sh_builtin(WORD_LIST *list)
+{
+    struct json2sh *ctx, *old;
+    char           *file = NULL, *var = NULL, *rs = "\n", *callback = NULL, *cmd = NULL;
+    WORD_LIST      *words;
+    char           *paths[JSON2SH_PATHS];
+    char           **argv;
+    int            opt, argc, bind = 0, lazy = 0, jobs = 0, stream = 0, npaths = 0, stats = 0, arrays = 0, assoc = 0, integers = 0, i;
+    intmax_t       depth = JSON2SH_DEPTH, n;
+    volatile int   ret;
+
+    /* json2sh query|get|drop .., see tape_main()	*/
+    if (list && (!strcmp(list->word->word, "query") || !strcmp(list->word->word, "get") || !strcmp(list->word->word, "drop")))
+    {
+        cmd  = list->word->word;
+        list = list->next;
+    }
+    words = list;
+
+    reset_internal_getopt();
+    while ((opt = internal_getopt(list, "aAbilj:f:v:sr:C:p:d:S")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            if (npaths >= JSON2SH_PATHS)
+            {
+                builtin_error("-p: at most %d selectors", JSON2SH_PATHS);
+                return EX_USAGE;
+            }
+            paths[npaths++] = list_optarg;
+            break;
+
+        case 'd':
+            if (!legal_number(list_optarg, &depth) || (depth < 1) || (depth > INT_MAX))
+            {
+                builtin_error("%s: invalid depth", list_optarg);
+                return EX_USAGE;
+            }
+            break;
+
+        case 'j':
+            if (!legal_number(list_optarg, &n) || (n < 1) || (n > JSON2SH_JOBS))
+            {
+                builtin_error("%s: invalid number of jobs", list_optarg);
+                return EX_USAGE;
+            }
+            jobs = n;
+            break;
+
+        case 'a':
+            arrays = 1;
+            break;
+
+        case 'A':
+            assoc = 1;
+            break;
+
+        case 'i':
+            integers = 1;
+            break;
+
+        case 'b':
+            bind = 1;
+            break;
+
+        case 'l':
+            lazy = 1;
+            break;
+
+        case 's':
+            stream = 1;
+            break;
+
+        case 'S':
+            stats = 1;
+            break;
+
+        case 'r':
+            rs = list_optarg;
+            break;
+
+        case 'C':
+            callback = list_optarg;
+            stream   = 1;
+            break;
+
+        case 'f':
+            file = list_optarg;
+            break;
+
+        case 'v':
+            var = list_optarg;
+            break;
+
+            CASE_HELPOPT;
+
+        default:
+            builtin_usage();
+            return EX_USAGE;
+        }
+    }
+    list = loptend;
+
+    if (lazy && (var || stream || arrays || assoc))
+    {
+        builtin_error("-l does not go with -v, -s, -C, -a and -A");
+        return EX_USAGE;
+    }
+    bind |= lazy;
+    if (jobs && (bind || callback || cmd || (list && file) || (!list && (stream || arrays))))
+    {
+        builtin_error("-j does not go with -b, -l and -C, with FILEs not with -f, else not with -s and -a");
+        return EX_USAGE;
+    }
+    if (var && bind)
+    {
+        builtin_error("-b and -v are mutually exclusive");
+        return EX_USAGE;
+    }
+    if (var && !legal_identifier(var))
+    {
+        sh_invalidid(var);
+        return EXECUTION_FAILURE;
+    }
+
+    /* Somebody called us while we are running (a trap for example)	*/
+    ctx = &json2sh_ctx;
+    if (ctx->busy && !(ctx = calloc(1, sizeof *ctx)))
+    {
+        builtin_error("out of memory");
+        return EXECUTION_FAILURE;
+    }
+    old = json2sh_enter(ctx);
+
+    J->bind_mode   = bind;
+    J->stream      = stream;
+    J->callback    = callback;
+    J->maxdepth    = depth;
+    J->stats       = stats;
+    J->arrays      = arrays;
+    J->assoc       = assoc;
+    J->integers    = integers;
+    J->ref         = 0;
+    J->nr          = 0;
+    J->bound.len   = 0;
+    J->err[0]      = 0;
+    J->ckey.len    = 0;
+    for (; words; words = words->next)
+    {
+        buf_add(&J->ckey, words->word->word, strlen(words->word->word) + 1);
+    }
+    argv = make_builtin_argv(list, &argc);
+    if (setjmp(J->oops))
+    {
+        json2sh_cleanup();
+        builtin_error("%s", J->err);
+        ret = JSON2SH_OOPS;
+    }
+    else
+    {
+        buf(&J->rs, rs);
+        for (i = 0; i < npaths; i++)
+        {
+            path_add(paths[i]);
+        }
+        if (cmd && (*cmd != 'q'))
+        {
+            sink_init(&J->out, var ? SINK_VAR : SINK_FD, 1, var);
+            ret = tape_main(cmd, argc, argv);
+            sink_close(&J->out, ret == 0);
+        }
+        else if (jobs && list)
+        {
+            sink_init(&J->out, var ? SINK_VAR : SINK_FD, 1, var);
+            ret = batch_main(jobs, argc, argv, rs, paths, npaths);
+            sink_close(&J->out, !ret || !var);
+        }
+        else if (in_open(file))
+        {
+            builtin_error("%s: %s", file, strerror(errno));
+            snprintf(J->err, sizeof J->err, "%s: %s", file, strerror(errno));
+            ret = EXECUTION_FAILURE;
+        }
+        else
+        {
+            sink_init(&J->out, bind ? SINK_MEM : var ? SINK_VAR : SINK_FD, 1, var);
+            if (lazy && !cmd)
+            {
+                lazy_open();
+            }
+            if ((J->npaths || J->lazy) && !jobs)
+            {
+                ix_start();
+            }
+            if (jobs)
+            {
+                ret = split_main(jobs, argc, argv, rs, paths, npaths);
+            }
+            else
+            {
+                ret = cmd ? tape_main(cmd, argc, argv) : cache_main(argc, argv);
+            }
+            sink_close(&J->out, !ret || (jobs && !var));    /* as it is after OOPS	*/
+            in_close();
+            lazy_close();
+            ret = ret == 42 ? EX_USAGE : ret;
+        }
+    }
+    fflush(stdout);
+    if (J->stats && !cmd)
+    {
+        fprintf(stderr, "%s: nodes %lu, allocs %lu, mallocs %lu, bytes %lu, keys %lu cached %lu, cache hits %lu misses %lu\n",
+                JSON2SH_NAME, J->arena.nodes, J->arena.allocs, J->arena.mallocs, (unsigned long)J->arena.bytes,
+                J->keyhits + J->keymisses, J->keyhits, cache_hits, cache_misses);
+    }
+    xfree(argv);
+    path_free();
+    bind_variable("JSON2SH_ERROR", J->err, 0);
+
+    json2sh_leave(old);
+    if (ctx != &json2sh_ctx)
+    {
+        json2sh_free(ctx);
+        free(ctx);
+    }
+    return ret;
+}
+
+
+/* Called by "enable -f hello.so json2sh"
+ */
+int
+json2sh_builtin_load(char *s)
+{
+    ix_init();
+    return 1;
+}
+
+
+/* Called by "enable -d json2sh"
+ */
+void
+json2sh_builtin_unload(char *s)
+{
+    struct tape *t;
+
+    lazy_unload();
+    json2sh_free(&json2sh_ctx);
+    while ((t = tapes))
+    {
+        tapes = t->next;
+        tape_free(t);
+    }
+    while (cache)
+    {
+        cache_drop(&cache);
+    }
+}
+
+
+char *json2sh_doc[] =
+{
+    "Convert JSON into shell variables.",
+    "",
+    "Without options print lines NAME=VALUE suitable for eval, as the",
+    "json2sh command does.  Names start with PREFIX (default JSON_).",
+    "",
+    "Options:",
+    "  -a\tan array of only strings, numbers and constants becomes",
+    "    \tone indexed array NAME=(V1 V2 ..), counting from 0.",
+    "    \tArrays holding objects or arrays are output as usual.",
+    "  -A\tan object becomes one associative array with the raw keys,",
+    "    \tdeclare -gA NAME=([KEY]=VALUE ..).  For a member which is",
+    "    \tan object or array, VALUE is the name it is output under.",
+    "    \tNames are built from PREFIX like without -A.  Members",
+    "    \twith an empty key or a NUL in the key, and arrays which",
+    "    \tare not one variable (without -a, or holding containers),",
+    "    \tare left out and output as usual.",
+    "  -i\tintegers which fit intmax_t get the integer attribute,",
+    "    \tthey are output as declare -gi NAME=VALUE.  Not within",
+    "    \t-a and -A arrays.",
+    "  -b\tbind the variables directly instead of printing them.",
+    "    \tValues are assigned unquoted, constants get the value",
+    "    \tof $JSON_true_, $JSON_false_, $JSON_null_, $JSON_empty_",
+    "    \tand $JSON_nothing_ like eval would do.",
+    "  -l\tlike -b, but only the members of the top-level value,",
+    "    \tor what -p selects, are bound.  Their values are skipped",
+    "    \tand decoded when the variable is first read, objects and",
+    "    \tarrays as their JSON text.  Until then a copy of the input",
+    "    \tis kept in memory.  Not with -v, -s, -C, -a and -A.",
+    "  -f FILE\tread FILE instead of stdin.  Regular files are mapped",
+    "    \tinto memory and parsed in place.",
+    "  -v VAR\tstore the output in the shell variable VAR instead of",
+    "    \tprinting it.",
+    "",
+    "  -s\tparse a stream of JSON values (NDJSON or just concatenated)",
+    "    \tuntil EOF.  Each value is a record, RS is printed after each.",
+    "    \tWith -b the variables of the previous record are unset first.",
+    "  -r RS\trecord separator, default is an empty line.",
+    "  -C CALLBACK\tevaluate CALLBACK after each record, with the record",
+    "    \tnumber as argument, like mapfile does.  Implies -s.  A non",
+    "    \tzero status stops and is returned.",
+    "  -p PATH\tonly output what is at or below PATH, can be repeated.",
+    "    \tPATH is a JSON Pointer (/a/0/b) or a dotted path with globs",
+    "    \t(a.*.b), array indexes count from 0.  Everything else is",
+    "    \tskipped quickly, only checking that brackets balance.",
+    "  -d DEPTH\tfail on values nested deeper than DEPTH (default 1000).",
+    "  -j N\tFILEs given as arguments are parsed on N threads.  Output is",
+    "    \tin the order of the FILEs, names of the Nth FILE start with",
+    "    \tJSON__N_ like for the Nth element of an array.  A FILE which",
+    "    \tfails is reported and left out, the status is that of the",
+    "    \tfirst.  Not with -b, -l, -C and -f, and not cached.",
+    "    \tWithout FILEs the elements of a top-level array in the",
+    "    \tinput are parsed in chunks on N threads, with the same",
+    "    \toutput.  Where the chunks start is found on the threads",
+    "    \ttoo, only input from a pipe is read in full first, on one.",
+    "    \tNot with -b, -l, -C, -s and -a, and not cached.",
+    "  -S\tprint the number of nodes and allocations to stderr,",
+    "    \tand the hits and misses of the cache.",
+    "",
+    "  json2sh query [-f FILE] [-d DEPTH] HANDLE",
+    "    \tparse the input once into a tape kept under HANDLE, which",
+    "    \treplaces an older one.  Nothing is output.",
+    "  json2sh get [-v VAR] HANDLE PATH",
+    "    \toutput the value at PATH (as for -p, the first match) of",
+    "    \tHANDLE: strings decoded, anything else as its JSON text.",
+    "    \tThe status is 1 if there is no such value.",
+    "  json2sh drop HANDLE",
+    "    \tforget HANDLE.",
+    "",
+    "Output for a FILE which is unchanged (same device, inode, size",
+    "and mtime) is served from memory when the command is the same.",
+    "Not cached are -b and -C, and input from stdin.  $JSON2SH_CACHE",
+    "is the size of the cache in bytes (default 16 MiB), 0 disables",
+    "it and query then always parses.",
+    "",
+    "On invalid input the status is 23 and JSON2SH_ERROR is set to",
+    "LINE:COLUMN: MESSAGE, else JSON2SH_ERROR is empty.  The output",
+    "up to the error is still written.  With -b the variables bound",
+    "before the error are kept, with -v VAR is left as is.",
+    (char *)NULL
+};
+
+struct builtin json2sh_struct =
+{
+    "json2sh",                  /* builtin name */
+    json2sh_builtin,            /* function implementing the builtin */
+    BUILTIN_ENABLED,            /* initial flags for builtin */
+    json2sh_doc,                /* array of long documentation strings. */
+    "json2sh [-aAi] [-b | -l | -v VAR] [-f FILE] [-s] [-r RS] [-C CALLBACK] [-p PATH] [-d DEPTH] [-S] [PREFIX [SEP [LF]]] | json2sh -j N [..] [FILE..] | json2sh query|get|drop ..", /* usage synopsis; becomes short_doc */
+    0                           /* reserved for internal use */
+};
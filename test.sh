@@ -1 +1,17 @@
 bash -c 'enable -f src/.libs/hello.so hello && hello'
+bash -c 'enable -f src/.libs/hello.so json2sh && json2sh -b <<< "{\"a\":[1,\"x y\"]}" && [ "$JSON__0_a_2_" = "x y" ]'
+bash -c 'enable -f src/.libs/hello.so json2sh && json2sh -a -b <<< "{\"a\":[1,\"x y\"]}" && [ "${JSON__0_a[1]}" = "x y" ]'
+bash -c 'enable -f src/.libs/hello.so json2sh && eval "$(json2sh -a <<< "{\"a\":[\"x\",\"\",\"z\"]}")" && [ "${#JSON__0_a[@]}" = 3 ] && [ "${JSON__0_a[2]}" = z ]'
+bash -c 'enable -f src/.libs/hello.so json2sh && json2sh -A -b <<< "{\"k y\":\"v\",\"o\":{}}" && [ "${JSON__0[k y]}" = v ] && [ "${JSON__0[o]}" = JSON__0_o_0 ]'
+bash -c 'enable -f src/.libs/hello.so json2sh && json2sh -A -a -b <<< "{\"c\":[1,2],\"o\":{\"k\":\"v\"},\"p\":[1,[2]]}" && declare -n c=${JSON__0[c]} o=${JSON__0[o]} && [ "${c[1]}" = 2 ] && [ "${o[k]}" = v ] && [ -z "${JSON__0[p]+x}" ] && [ "$JSON__0_p_1_" = 1 ]'
+bash -c 'enable -f src/.libs/hello.so json2sh && d=$(mktemp -d) && j="{\"a\\u0000\$(touch $d/x)\":\"v\",\"z\":\"c\"}" && eval "$(json2sh -A <<< "$j")" && json2sh -A -b <<< "$j" && [ ! -e "$d/x" ]; r=$?; rm -rf "$d"; [ $r = 0 ] && [ "${JSON__0[z]}" = c ] && [ "${#JSON__0[@]}" = 1 ]'
+bash -c 'enable -f src/.libs/hello.so json2sh && json2sh -b <<< "[\"\\u00e9\\ud83d\\ude00\"]" && [ "$JSON__1_" = "é😀" ] && ! json2sh -b <<< "[\"\\ud83d\"]"'
+bash -c 'enable -f src/.libs/hello.so json2sh && json2sh query h <<< "{\"a\":[1,{\"b\":\"x y\"}]}" && json2sh get -v v h /a/1/b && [ "$v" = "x y" ] && ! json2sh get h /a/2 && json2sh drop h'
+bash -c 'enable -f src/.libs/hello.so json2sh && json2sh query h <<< "{\"a\":[1,{\"b\":\"x y\"}]}" && json2sh get -v v h "a.*.b" && [ "$v" = "x y" ]'
+bash -c 'enable -f src/.libs/hello.so json2sh && f=$(mktemp) && echo "[1]" > "$f" && json2sh -v a -f "$f" && json2sh -v b -f "$f" && echo "[22]" > "$f" && json2sh -v c -f "$f"; rm -f "$f"; [ "$a" = "$b" ] && [[ $c = "JSON__1_=22"* ]]'
+bash -c 'enable -f src/.libs/hello.so json2sh && json2sh -l <<< "{\"a\":[1,2],\"s\":\"x\\u0041y\",\"n\":3}" && [ "$JSON__0_a" = "[1,2]" ] && [ "$JSON__0_s" = xAy ] && JSON__0_n=z && [ "$JSON__0_n" = z ]'
+bash -c 'enable -f src/.libs/hello.so json2sh && f=$(mktemp) && echo "{\"a\":[1,2]}" > "$f" && json2sh -l -f "$f" && : > "$f"; rm -f "$f"; [ "$JSON__0_a" = "[1,2]" ]'
+bash -c 'enable -f src/.libs/hello.so json2sh && d=$(mktemp -d) && echo "[1]" > "$d/a" && echo "{\"b\":2}" > "$d/b" && json2sh -v out -j 2 "$d/a" "$d/b"; rm -rf "$d"; eval "$out" && [ "$JSON__1__1_" = 1 ] && [ "$JSON__2_b" = 2 ]'
+bash -c 'enable -f src/.libs/hello.so json2sh && d=$(mktemp -d) && echo "[1," > "$d/a" && json2sh -j 2 "$d/a" "$d/b" 2>/dev/null; rm -rf "$d"; [[ $JSON2SH_ERROR = */a:* ]]'
+bash -c 'enable -f src/.libs/hello.so json2sh && json2sh -v out -j 2 <<< "[1,{\"a\":2}]" && eval "$out" && [ "$JSON__1_" = 1 ] && [ "$JSON__2_a" = 2 ]'
+bash -c 'enable -f src/.libs/hello.so json2sh && json2sh -v out -p want < <(printf "{\"skip\":\"abc\\\\"; sleep .3; printf "\"]]]}}}\",\"want\":1}\n") && [[ $out = "JSON__0_want=1"* ]]'